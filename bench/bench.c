@@ -0,0 +1,1335 @@
+/**
+ * @file bench.c
+ * @brief Kernel micro-benchmarks (host build, "make bench").
+ *
+ * Each line of the output is a CSV record:
+ *    bench,config,n,ops,cycles_per_op,ns_per_op
+ * where n is the number of threads, callbacks or timers in the test.
+ * The occupancy of the wait queues in the signal test is reported on stderr.
+ * With CRONOS_LOAD, cpu_load() is checked against synthetic busy/idle workloads
+ * (stderr); the exit status is 1 if it is off by more than LOAD_TOLERANCE in LOAD_TRIES
+ * measurements in a row (the host may take the CPU away during one of them).
+ * With CRONOS_EDF, periodic task sets of growing utilization are run with deadlines (EDF)
+ * and with rate-monotonic fixed priorities, and the deadline misses are compared (stderr).
+ * Semaphores (counts, hand-off, timeouts) and event groups (ANY, ALL and CLEAR wakeups)
+ * are checked, also from an interrupt handler, as well as the order of queued messages
+ * and the queue timeouts; the exit status is 1 on a mismatch (stderr).
+ *
+ * @author Bruno Basseto (bruno@wise-ware.org)
+ * @version 0
+ */
+
+/********************************************************************************
+ ********************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 1995-2014 Bruno Basseto.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************
+ ********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "chronos.h"
+#include "config.h"
+#include "threads.h"
+
+#if POOL_CALLBACKS > 0
+#define CONFIG                  "pool"
+#else
+#define CONFIG                  "malloc"
+#endif
+
+#define STACK                   8192
+#define OPS                     100000            // operations per measurement (approximately)
+#define MAX_N                   1000
+
+static const uint16_t counts[] = { 1, 10, 100, 1000 };
+static const uint16_t loads[] = { 0, 25, 50, 75, 100 };
+
+static double _cycles_ns;                         // cycles per nanosecond
+static uint16_t _n;                               // threads/callbacks in the current test
+static uint32_t _iter;                            // iterations per thread
+static volatile uint16_t _next_id;
+static volatile bool_t _stop;
+static byte_t _objs[MAX_N + 1];                   // signal objects
+static byte_t _lock;
+static kmutex_t _mutex;
+static volatile word_t _t0;
+static uint64_t _cycles;
+static uint32_t _ops;
+static uint32_t _failed;                          // checks failed
+static thread_t *_th[MAX_N];
+
+/**
+ * Monotonic time in nanoseconds.
+ */
+static uint64_t
+now_ns
+   (void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Measures the cycle counter frequency.
+ */
+static void
+calibrate
+   (void)
+{
+   uint64_t t;
+   word_t c;
+
+   t = now_ns();
+   c = cycle_count();
+   while(now_ns() - t < 50000000ull);
+   _cycles_ns = (double)(cycle_count() - c) / (double)(now_ns() - t);
+}
+
+/**
+ * Prints a result line.
+ */
+static void
+report
+   (const char *bench,
+   uint16_t n,
+   uint64_t cycles,
+   uint32_t ops)
+{
+   double c;
+
+   if(ops == 0) ops = 1;
+   c = (double)cycles / ops;
+   printf("%s,%s,%u,%u,%.1f,%.1f\n", bench, CONFIG, n, ops, c, c / _cycles_ns);
+   fflush(stdout);
+}
+
+/**
+ * Reports a failed check on stderr.
+ */
+static void
+expect
+   (bool_t ok,
+   const char *what)
+{
+   if(ok) return;
+   fprintf(stderr, "check failed: %s\n", what);
+   _failed++;
+}
+
+/**
+ * Iterations per thread for about OPS operations.
+ */
+static uint32_t
+iterations
+   (uint16_t n)
+{
+   uint32_t i;
+
+   i = OPS / n;
+   return (i < 10)? 10 : i;
+}
+
+/**
+ * Runs the scheduler until all threads are finished.
+ */
+static void
+run_all
+   (void)
+{
+   while(os_count_threads()) scheduler();
+}
+
+/**
+ * Thread waiting for its object, until _stop.
+ */
+static void
+parked
+   (void)
+{
+   uint16_t id;
+
+   id = _next_id++;
+   while(!_stop) thread_wait(&_objs[id]);
+}
+
+/**
+ * Creates n-1 parked threads, so that the wait queues hold n threads with the measuring one.
+ */
+static void
+park
+   (uint16_t n)
+{
+   uint16_t i;
+
+   for(i=1; i<n; i++) thread_create(parked, STACK);
+   for(i=1; i<n; i++) scheduler();                // all waiting.
+}
+
+/**
+ * Releases all parked threads.
+ */
+static void
+unpark
+   (void)
+{
+   uint16_t i;
+
+   _stop = TRUE;
+   for(i=0; i<=MAX_N; i++) thread_signal(&_objs[i]);
+}
+
+/**
+ * Starts a test.
+ */
+static void
+setup
+   (uint16_t n)
+{
+   kernel_init(2560000);
+   _n = n;
+   _iter = iterations(n);
+   _next_id = 0;
+   _stop = FALSE;
+   _cycles = 0;
+   _ops = 0;
+}
+
+// -----
+// yield
+// -----
+static void
+yielder
+   (void)
+{
+   uint32_t i;
+
+   for(i=0; i<_iter; i++) thread_yield();
+}
+
+/**
+ * Yield round-trip (thread -> main -> next thread) with n ready threads.
+ */
+static void
+bench_yield
+   (uint16_t n)
+{
+   uint16_t i;
+   word_t c;
+
+   setup(n);
+   for(i=0; i<n; i++) thread_create(yielder, STACK);
+   c = cycle_count();
+   run_all();
+   report("yield", n, cycle_count() - c, (uint32_t)n * _iter);
+}
+
+// --------------
+// signal -> wake
+// --------------
+static void
+waiter
+   (void)
+{
+   uint16_t id;
+
+   id = _next_id++;
+   for(;;) {
+      thread_wait(&_objs[id]);
+      if(_stop) break;
+      _cycles += cycle_count() - _t0;
+      _ops++;
+   }
+}
+
+static void
+signaler
+   (void)
+{
+   uint32_t j;
+
+   for(j=0; j<OPS; j++) {
+      _t0 = cycle_count();
+      thread_signal(&_objs[j % _n]);
+      thread_yield();
+   }
+   unpark();
+}
+
+/**
+ * Occupancy of the wait queues (stderr): buckets holding threads, and the longest one,
+ * which bounds the threads a signal looks at.
+ */
+static void
+waitq_report
+   (uint16_t n)
+{
+   uint16_t i, used, longest, len;
+
+   used = longest = 0;
+   for(i=0; i<WAITQ_SIZE; i++) {
+      len = list_length(_waitq[i]);
+      if(len) used++;
+      if(len > longest) longest = len;
+   }
+   fprintf(stderr, "waitq,%u,%u,%u,%u\n", n, WAITQ_SIZE, used, longest);
+}
+
+/**
+ * Latency from thread_signal to the waiting thread running, with n waiting threads.
+ */
+static void
+bench_signal
+   (uint16_t n)
+{
+   uint16_t i;
+
+   setup(n);
+   for(i=0; i<n; i++) thread_create(waiter, STACK);
+   for(i=0; i<n; i++) scheduler();                // all waiting.
+   waitq_report(n);
+   thread_create(signaler, STACK);
+   run_all();
+   report("signal_wake", n, _cycles, _ops);
+}
+
+// ---------------
+// stackless tasks
+// ---------------
+typedef struct {
+   thread_t th;
+   uint32_t i;
+   uint16_t id;
+} btask_t;
+static btask_t _tasks[MAX_N];
+
+static void
+task_yielder
+   (void *p)
+{
+   btask_t *t;
+
+   t = p;
+   TASK_BEGIN(t);
+   for(t->i=0; t->i<_iter; t->i++) TASK_YIELD(t);
+   _next_id++;
+   TASK_END(t);
+}
+
+/**
+ * Yield round-trip (task -> main -> next task) with n ready stackless tasks.
+ */
+static void
+bench_task_yield
+   (uint16_t n)
+{
+   uint16_t i;
+   word_t c;
+
+   setup(n);
+   for(i=0; i<n; i++) task_create_static(&_tasks[i].th, task_yielder);
+   c = cycle_count();
+   while(_next_id < n) scheduler();               // os_count_threads() would dominate here.
+   report("task_yield", n, cycle_count() - c, (uint32_t)n * _iter);
+}
+
+static void
+task_waiter
+   (void *p)
+{
+   btask_t *t;
+
+   t = p;
+   TASK_BEGIN(t);
+   t->id = _next_id++;
+   for(;;) {
+      TASK_WAIT(t, &_objs[t->id]);
+      if(_stop) break;
+      _cycles += cycle_count() - _t0;
+      _ops++;
+   }
+   TASK_END(t);
+}
+
+/**
+ * Latency from thread_signal to the waiting task running, with n waiting stackless tasks.
+ */
+static void
+bench_task_signal
+   (uint16_t n)
+{
+   uint16_t i;
+
+   setup(n);
+   for(i=0; i<n; i++) task_create_static(&_tasks[i].th, task_waiter);
+   for(i=0; i<n; i++) scheduler();                // all waiting.
+   thread_create(signaler, STACK);
+   while(!_stop) scheduler();
+   run_all();
+   report("task_signal_wake", n, _cycles, _ops);
+}
+
+/**
+ * Cost of thread_signal_from_isr in the interrupt handler and latency to the waiting thread
+ * running, with n waiting threads. Main plays the interrupt handler.
+ */
+static void
+bench_isr
+   (uint16_t n)
+{
+   uint64_t post;
+   uint32_t j;
+   uint16_t i;
+   word_t c;
+
+   setup(n);
+   for(i=0; i<n; i++) thread_create(waiter, STACK);
+   for(i=0; i<n; i++) scheduler();                // all waiting.
+   post = 0;
+   for(j=0; j<OPS; j++) {
+      c = cycle_count();
+      _t0 = c;
+      thread_signal_from_isr(&_objs[j % n]);
+      post += cycle_count() - c;
+      scheduler();
+   }
+   report("isr_post", n, post, OPS);
+   report("isr_wake", n, _cycles, _ops);
+   unpark();
+   run_all();
+}
+
+// --------------
+// message queues
+// --------------
+static kqueue_t _queue;
+static void *_queue_buf[16];
+
+static void
+producer
+   (void)
+{
+   uint32_t j;
+
+   _t0 = cycle_count();
+   for(j=0; j<OPS; j++) queue_send(&_queue, &_objs[j % (MAX_N + 1)]);
+}
+
+static void
+consumer
+   (void)
+{
+   void *m;
+   uint32_t j, lost;
+
+   lost = 0;
+   for(j=0; j<OPS; j++) {
+      if(!queue_receive(&_queue, &m) || (m != &_objs[j % (MAX_N + 1)])) lost++;
+   }
+   _cycles = cycle_count() - _t0;
+   expect(lost == 0, "queue: messages out of order or lost");
+   unpark();
+}
+
+/**
+ * Message transfer through a 16-slot queue between two threads, with n threads in the wait queues.
+ * The messages must arrive in the order sent.
+ */
+static void
+bench_queue
+   (uint16_t n)
+{
+   setup(n);
+   queue_init(&_queue, _queue_buf, 16);
+   park(n);
+   thread_create(consumer, STACK);
+   thread_create(producer, STACK);
+   run_all();
+   report("queue", n, _cycles, OPS);
+}
+
+// -----------
+// uncontended
+// -----------
+static void
+locker
+   (void)
+{
+   uint32_t i;
+   word_t c;
+
+   c = cycle_count();
+   for(i=0; i<OPS; i++) {
+      thread_lock(&_lock);
+      thread_unlock(&_lock);
+   }
+   _cycles = cycle_count() - c;
+   c = cycle_count();
+   for(i=0; i<OPS; i++) {
+      mutex_lock(&_mutex);
+      mutex_unlock(&_mutex);
+   }
+   _t0 = cycle_count() - c;
+   unpark();
+}
+
+/**
+ * Uncontended lock + unlock, with n threads in the wait queues.
+ */
+static void
+bench_lock
+   (uint16_t n)
+{
+   setup(n);
+   _lock = 0;
+   mutex_init(&_mutex, FALSE);
+   park(n);
+   thread_create(locker, STACK);
+   run_all();
+   report("lock_uncontended", n, _cycles, OPS);
+   report("mutex_uncontended", n, _t0, OPS);
+}
+
+// ---------
+// contended
+// ---------
+static void
+contender
+   (void)
+{
+   uint32_t i;
+
+   for(i=0; i<_iter; i++) {
+      thread_lock(&_lock);
+      thread_yield();
+      thread_unlock(&_lock);
+      thread_yield();
+   }
+}
+
+static void
+mutex_contender
+   (void)
+{
+   uint32_t i;
+
+   for(i=0; i<_iter; i++) {
+      mutex_lock(&_mutex);
+      thread_yield();
+      mutex_unlock(&_mutex);
+      thread_yield();
+   }
+}
+
+/**
+ * n threads holding the same lock across a yield.
+ */
+static void
+bench_contended
+   (uint16_t n)
+{
+   uint16_t i;
+   word_t c;
+
+   setup(n);
+   _lock = 0;
+   for(i=0; i<n; i++) thread_create(contender, STACK);
+   c = cycle_count();
+   run_all();
+   report("lock_contended", n, cycle_count() - c, (uint32_t)n * _iter);
+
+   setup(n);
+   mutex_init(&_mutex, FALSE);
+   for(i=0; i<n; i++) thread_create(mutex_contender, STACK);
+   c = cycle_count();
+   run_all();
+   report("mutex_contended", n, cycle_count() - c, (uint32_t)n * _iter);
+}
+
+// ---------
+// callbacks
+// ---------
+static void
+nop
+   (void *par)
+{
+   _ops++;
+}
+
+/**
+ * callback_fire + dispatch, n callbacks per scheduler pass.
+ */
+static void
+bench_callback
+   (uint16_t n)
+{
+   uint32_t r;
+   uint16_t i;
+   word_t c;
+
+   setup(n);
+   c = cycle_count();
+   for(r=0; r<_iter; r++) {
+      for(i=0; i<n; i++) callback_fire(nop, NULL, 0);
+      scheduler();
+   }
+   report("callback", n, cycle_count() - c, _ops);
+}
+
+/**
+ * callback_schedule + dispatch of n callback handles, rescheduled every pass.
+ */
+static void
+bench_callback_handle
+   (uint16_t n)
+{
+   static callback_t *cb[MAX_N];
+   uint32_t r;
+   uint16_t i;
+   word_t c;
+
+   setup(n);
+   for(i=0; i<n; i++) cb[i] = callback_create(nop, NULL);
+   c = cycle_count();
+   for(r=0; r<_iter; r++) {
+      for(i=0; i<n; i++) callback_schedule(cb[i], 0);
+      scheduler();
+   }
+   report("callback_handle", n, cycle_count() - c, _ops);
+   for(i=0; i<n; i++) callback_delete(cb[i]);
+}
+
+// ----
+// tick
+// ----
+static void
+sleeper
+   (void)
+{
+   thread_sleep(1000000 + _next_id++);
+}
+
+static void
+pending
+   (void *par)
+{
+}
+
+/**
+ * Cost of one tick interrupt with n sleeping threads and n pending callbacks.
+ */
+static void
+bench_tick
+   (uint16_t n)
+{
+   uint16_t i;
+   uint32_t t;
+   word_t c;
+
+   setup(n);
+   for(i=0; i<n; i++) {
+      _th[i] = thread_create(sleeper, STACK);
+      callback_fire(pending, NULL, 2000000 + i);
+   }
+   for(i=0; i<n; i++) scheduler();
+   c = cycle_count();
+   for(t=0; t<OPS; t++) port_tick(1);
+   report("tick", n, cycle_count() - c, OPS);
+
+   for(i=0; i<n; i++) thread_kill(_th[i]);
+   callback_cancel(pending);
+}
+
+// ---------------------------
+// semaphores and event groups
+// ---------------------------
+typedef struct {
+   uint32_t mask;                                 // flags waited for
+   byte_t mode;
+   word_t timeout;                                // ticks, 0 = none
+   uint32_t got;                                  // result of the wait
+   uint32_t tick;                                 // tick of the result
+   bool_t done;
+} sync_wait_t;
+
+static ksem_t _sem;
+static kevent_t _event;
+static sync_wait_t _waits[4];
+static uint16_t _order[4];
+static uint16_t _done;
+/**
+ * Runs the scheduler until no thread is ready.
+ */
+static void
+settle
+   (void)
+{
+   do scheduler(); while(os_count_ready());
+}
+
+/**
+ * Runs the scheduler, one tick at a time, until the waiting thread of the given slot is done.
+ */
+static void
+settle_until
+   (uint16_t id)
+{
+   uint16_t n;
+
+   for(n=0; !_waits[id].done && (n < 100); n++) {
+      port_tick(1);
+      settle();
+   }
+}
+
+/**
+ * Thread waiting for the semaphore, with priority and timeout of its slot (mode = priority).
+ */
+static void
+sem_waiter
+   (void)
+{
+   sync_wait_t *w;
+   uint16_t id;
+
+   id = _next_id++;
+   w = &_waits[id];
+   thread_priority(w->mode);
+   if(w->timeout) thread_set_timeout(w->timeout);
+   w->got = sem_wait(&_sem);
+   w->tick = ticks;
+   w->done = TRUE;
+   _order[_done++] = id;
+}
+
+/**
+ * Thread waiting for flags of the event group, as set in its slot.
+ */
+static void
+event_waiter
+   (void)
+{
+   sync_wait_t *w;
+
+   w = &_waits[_next_id++];
+   if(w->timeout) thread_set_timeout(w->timeout);
+   w->got = event_wait(&_event, w->mask, w->mode);
+   w->tick = ticks;
+   w->done = TRUE;
+}
+
+/**
+ * Starts n waiting threads of a check, from the slots set by the caller.
+ */
+static void
+sync_start
+   (void (*fn)(void),
+   uint16_t n)
+{
+   uint16_t i;
+
+   setup(n);
+   _done = 0;
+   for(i=0; i<n; i++) thread_create(fn, STACK);
+   settle();
+}
+
+/**
+ * Semaphore counts, hand-off by priority, posts from an interrupt handler and timeouts.
+ */
+static void
+sem_check
+   (void)
+{
+   uint32_t t0;
+
+   /*
+    * Counts and limit, without waiting.
+    */
+   sem_init(&_sem, 2, 3);
+   expect(sem_trywait(&_sem) && sem_trywait(&_sem), "sem: take the initial count");
+   expect(!sem_trywait(&_sem), "sem: take from zero");
+   expect(sem_post(&_sem) && sem_post(&_sem) && sem_post(&_sem), "sem: post up to the limit");
+   expect(!sem_post(&_sem), "sem: post over the limit");
+   expect(_sem.count == 3, "sem: count at the limit");
+   sem_init(&_sem, 0, 0);
+
+   /*
+    * Two waiters: the highest priority one gets the first unit, the count stays at zero.
+    */
+   memset(_waits, 0, sizeof(_waits));
+   _waits[1].mode = 2;
+   sync_start(sem_waiter, 2);
+   expect(!_waits[0].done && !_waits[1].done, "sem: wait at zero");
+   sem_post(&_sem);
+   settle();
+   expect(_waits[1].done && !_waits[0].done, "sem: hand-off to the highest priority");
+   sem_post_from_isr(&_sem);
+   settle();
+   expect(_waits[0].done && _waits[0].got && _waits[1].got, "sem: post from isr");
+   expect((_order[0] == 1) && (_order[1] == 0), "sem: hand-off order");
+   expect(_sem.count == 0, "sem: count after the hand-offs");
+
+   /*
+    * Timeout expiring, then a timeout cancelled by a post.
+    */
+   memset(_waits, 0, sizeof(_waits));
+   _waits[0].timeout = 5;
+   sync_start(sem_waiter, 1);
+   t0 = ticks;                                    // kernel_init restarts the tick count.
+   settle_until(0);
+   expect(_waits[0].done && !_waits[0].got, "sem: timeout");
+   expect(_waits[0].tick == t0 + 5, "sem: timeout tick");
+
+   memset(_waits, 0, sizeof(_waits));
+   _waits[0].timeout = 5;
+   sync_start(sem_waiter, 1);
+   port_tick(2);
+   sem_post(&_sem);
+   settle();
+   expect(_waits[0].done && _waits[0].got, "sem: post before the timeout");
+   expect(_sem.count == 0, "sem: count after a timed wait");
+}
+
+/**
+ * Event groups: ANY, ALL and CLEAR wakeup sets, posts from an interrupt handler and timeouts.
+ */
+static void
+event_check
+   (void)
+{
+   uint32_t t0;
+
+   /*
+    * 0: any of 0x03; 1: all of 0x06, consumed; 2: any of 0x08, consumed.
+    */
+   event_init(&_event, 0);
+   memset(_waits, 0, sizeof(_waits));
+   _waits[0].mask = 0x03;
+   _waits[0].mode = EV_ANY;
+   _waits[1].mask = 0x06;
+   _waits[1].mode = EV_ALL | EV_CLEAR;
+   _waits[2].mask = 0x08;
+   _waits[2].mode = EV_ANY | EV_CLEAR;
+   sync_start(event_waiter, 3);
+   expect(!_waits[0].done && !_waits[1].done && !_waits[2].done, "event: wait with no flags");
+   event_post(&_event, 0x01);
+   settle();
+   expect(_waits[0].done && (_waits[0].got == 0x01), "event: any");
+   expect(!_waits[1].done && !_waits[2].done, "event: any releases no other set");
+   expect(_event.flags == 0x01, "event: any keeps the flags");
+   event_post(&_event, 0x02);
+   settle();
+   expect(!_waits[1].done, "event: all with part of the flags");
+   event_post_from_isr(&_event, 0x04);
+   settle();
+   expect(_waits[1].done && (_waits[1].got == 0x06), "event: all from isr");
+   expect(!_waits[2].done, "event: all releases no other set");
+   expect(_event.flags == 0x01, "event: all consumes its flags");
+   event_post(&_event, 0x08);
+   settle();
+   expect(_waits[2].done && (_waits[2].got == 0x08), "event: any, consumed");
+   expect(_event.flags == 0x01, "event: consumed flags");
+
+   /*
+    * Two consuming waiters of the same flag: one release per post, in arrival order.
+    */
+   event_init(&_event, 0);
+   memset(_waits, 0, sizeof(_waits));
+   _waits[0].mask = _waits[1].mask = 0x10;
+   _waits[0].mode = _waits[1].mode = EV_ANY | EV_CLEAR;
+   sync_start(event_waiter, 2);
+   event_post(&_event, 0x10);
+   settle();
+   expect(_waits[0].done && !_waits[1].done, "event: clear releases one waiter");
+   event_post(&_event, 0x10);
+   settle();
+   expect(_waits[1].done && (_event.flags == 0), "event: clear, second post");
+
+   /*
+    * Condition already met, then a timeout.
+    */
+   event_init(&_event, 0x05);
+   memset(_waits, 0, sizeof(_waits));
+   _waits[0].mask = 0x05;
+   _waits[0].mode = EV_ALL;
+   sync_start(event_waiter, 1);
+   expect(_waits[0].done && (_waits[0].got == 0x05), "event: all, already set");
+   event_clear(&_event, 0x04);
+   expect(_event.flags == 0x01, "event: clear");
+
+   memset(_waits, 0, sizeof(_waits));
+   _waits[0].mask = 0x05;
+   _waits[0].mode = EV_ALL;
+   _waits[0].timeout = 3;
+   sync_start(event_waiter, 1);
+   t0 = ticks;                                    // kernel_init restarts the tick count.
+   settle_until(0);
+   expect(_waits[0].done && (_waits[0].got == 0), "event: timeout");
+   expect(_waits[0].tick == t0 + 3, "event: timeout tick");
+}
+
+// -------------------
+// message queue order
+// -------------------
+#define QUEUE_CHECK_SIZE        4
+#define NO_MESSAGE              (MAX_N + 1)
+static void *_check_buf[QUEUE_CHECK_SIZE];
+
+/**
+ * Thread sending the message of its slot (mask = index in _objs), with the timeout of its slot.
+ */
+static void
+queue_sender
+   (void)
+{
+   sync_wait_t *w;
+
+   w = &_waits[_next_id++];
+   if(w->timeout) thread_set_timeout(w->timeout);
+   w->got = queue_send(&_queue, &_objs[w->mask]);
+   w->tick = ticks;
+   w->done = TRUE;
+}
+
+/**
+ * Thread receiving one message, with the timeout of its slot (got = index in _objs).
+ */
+static void
+queue_receiver
+   (void)
+{
+   sync_wait_t *w;
+   void *m;
+
+   w = &_waits[_next_id++];
+   if(w->timeout) thread_set_timeout(w->timeout);
+   if(queue_receive(&_queue, &m)) w->got = (byte_t *)m - _objs;
+   else w->got = NO_MESSAGE;
+   w->tick = ticks;
+   w->done = TRUE;
+}
+
+/**
+ * Sends messages first..first+n-1 without waiting.
+ */
+static bool_t
+queue_fill
+   (uint16_t first,
+   uint16_t n)
+{
+   uint16_t i;
+
+   for(i=0; i<n; i++) {
+      if(!queue_trysend(&_queue, &_objs[first + i])) return FALSE;
+   }
+   return TRUE;
+}
+
+/**
+ * Takes all messages of the queue, checking them against the sequence first..first+n-1.
+ */
+static bool_t
+queue_drain
+   (uint16_t first,
+   uint16_t n)
+{
+   uint16_t i;
+   void *m;
+
+   for(i=0; i<n; i++) {
+      if(!queue_tryreceive(&_queue, &m) || (m != &_objs[first + i])) return FALSE;
+   }
+   return !queue_tryreceive(&_queue, &m);
+}
+
+/**
+ * Message queues: FIFO order across the ring, sends from an interrupt handler and timeouts.
+ */
+static void
+queue_check
+   (void)
+{
+   uint32_t t0;
+   void *m;
+
+   /*
+    * Sends from main and from an interrupt handler; reserved slots count as taken.
+    */
+   setup(1);
+   queue_init(&_queue, _check_buf, QUEUE_CHECK_SIZE);
+   expect(queue_fill(0, 2), "queue: send");
+   expect(queue_send_from_isr(&_queue, &_objs[2]) && queue_send_from_isr(&_queue, &_objs[3]), "queue: send from isr");
+   expect(!queue_send_from_isr(&_queue, &_objs[4]) && !queue_trysend(&_queue, &_objs[4]), "queue: reserved slots");
+   settle();
+   expect((queue_count(&_queue) == QUEUE_CHECK_SIZE) && (_queue.reserved == 0), "queue: isr messages delivered");
+   expect(queue_drain(0, 4), "queue: order");
+
+   /*
+    * Wrap around the end of the ring.
+    */
+   expect(queue_fill(5, 3), "queue: send");
+   expect(queue_tryreceive(&_queue, &m) && (m == &_objs[5]), "queue: receive");
+   expect(queue_fill(8, 2), "queue: send across the end");
+   expect(queue_drain(6, 4), "queue: order across the end");
+
+   /*
+    * From an interrupt handler to a waiting receiver.
+    */
+   memset(_waits, 0, sizeof(_waits));
+   sync_start(queue_receiver, 1);
+   expect(!_waits[0].done, "queue: receive from empty");
+   queue_send_from_isr(&_queue, &_objs[10]);
+   settle();
+   expect(_waits[0].done && (_waits[0].got == 10) && (queue_count(&_queue) == 0), "queue: isr to a waiting receiver");
+
+   /*
+    * Timeouts: receiving from an empty queue, sending to a full one.
+    */
+   memset(_waits, 0, sizeof(_waits));
+   _waits[0].timeout = 4;
+   sync_start(queue_receiver, 1);
+   t0 = ticks;                                    // kernel_init restarts the tick count.
+   settle_until(0);
+   expect(_waits[0].done && (_waits[0].got == NO_MESSAGE), "queue: receive timeout");
+   expect(_waits[0].tick == t0 + 4, "queue: receive timeout tick");
+
+   memset(_waits, 0, sizeof(_waits));
+   expect(queue_fill(11, 4), "queue: fill");
+   _waits[0].mask = 15;
+   _waits[0].timeout = 4;
+   sync_start(queue_sender, 1);
+   t0 = ticks;                                    // kernel_init restarts the tick count.
+   expect(!_waits[0].done, "queue: send to full");
+   settle_until(0);
+   expect(_waits[0].done && !_waits[0].got, "queue: send timeout");
+   expect(_waits[0].tick == t0 + 4, "queue: send timeout tick");
+   expect(queue_drain(11, 4), "queue: no message after a send timeout");
+
+   /*
+    * A slot released before the timeout: the message goes to the end of the queue.
+    */
+   memset(_waits, 0, sizeof(_waits));
+   expect(queue_fill(16, 4), "queue: fill");
+   _waits[0].mask = 20;
+   _waits[0].timeout = 4;
+   sync_start(queue_sender, 1);
+   port_tick(2);
+   expect(queue_tryreceive(&_queue, &m) && (m == &_objs[16]), "queue: receive from full");
+   settle();
+   expect(_waits[0].done && _waits[0].got, "queue: send before the timeout");
+   expect(queue_drain(17, 4), "queue: order after a waiting send");
+
+   /*
+    * A message from a thread after one from an interrupt handler, not yet delivered:
+    * the order holds with or without a waiting receiver.
+    */
+   expect(queue_send_from_isr(&_queue, &_objs[21]) && queue_fill(22, 1), "queue: send after isr");
+   settle();
+   expect(queue_drain(21, 2), "queue: order after isr");
+
+   memset(_waits, 0, sizeof(_waits));
+   sync_start(queue_receiver, 1);
+   expect(queue_send_from_isr(&_queue, &_objs[23]) && queue_fill(24, 1), "queue: send after isr");
+   expect(!_waits[0].done, "queue: no hand-off before the isr message");
+   settle();
+   expect(_waits[0].done && (_waits[0].got == 23), "queue: isr message first");
+   expect(queue_drain(24, 1), "queue: thread message next");
+}
+
+#ifdef CRONOS_LOAD
+// --------
+// CPU load
+// --------
+#define LOAD_CYCLES             50000             // cycles per tick in the load test
+#define LOAD_TOLERANCE          30                // thousandths
+#define LOAD_TRIES              3                 // measurements before a load point fails
+
+static volatile word_t _busy;
+static volatile word_t _idle_spin;
+static uint16_t _governed;
+
+/**
+ * Idle time of the load test: the idle hook spins for the rest of the tick.
+ */
+void
+idle_hook
+   (void)
+{
+   if(_idle_spin == 0) return;
+   delay(_idle_spin);
+   port_tick(1);
+}
+
+static void
+load_governor
+   (uint16_t load)
+{
+   _governed = load;
+}
+
+/**
+ * Synthetic workload: busy for a share of each tick, sleeping for the rest.
+ */
+static void
+load_worker
+   (void)
+{
+   while(!_stop) {
+      delay(_busy);
+      thread_sleep(1);
+   }
+}
+
+/**
+ * Checks cpu_load against a synthetic workload of the given load (in percent), on stderr.
+ * @return FALSE if the measured load is off by more than LOAD_TOLERANCE.
+ */
+static bool_t
+load_check
+   (uint16_t pct)
+{
+   uint16_t load, target;
+
+   setup(1);
+   _busy = LOAD_CYCLES * pct / 100;
+   _idle_spin = LOAD_CYCLES - _busy + 1;
+   _governed = 0;
+   cpu_governor(load_governor);
+   thread_create(load_worker, STACK);
+   while(ticks < (LOAD_WINDOW + 1) * LOAD_PERIOD) scheduler();
+   load = cpu_load();
+   _stop = TRUE;
+   _idle_spin = 0;
+   while(os_count_threads()) {
+      scheduler();
+      port_tick(1);
+   }
+
+   target = pct * 10;
+   fprintf(stderr, "%u,%u,%u\n", target, load, _governed);
+   return ((load + LOAD_TOLERANCE >= target) && (load <= target + LOAD_TOLERANCE)
+      && (_governed + LOAD_TOLERANCE >= target) && (_governed <= target + LOAD_TOLERANCE));
+}
+#endif
+
+#ifdef CRONOS_EDF
+// ---------
+// deadlines
+// ---------
+#define EDF_TASKS               5
+#define EDF_TICKS               20000             // length of each run
+static const uint16_t periods[EDF_TASKS] = { 40, 60, 100, 140, 220 };
+static const uint8_t rm_prio[EDF_TASKS] = { 2, 2, 1, 0, 0 };
+static const uint16_t utilizations[] = { 50, 70, 80, 90, 95, 100 };
+static word_t _wcet[EDF_TASKS];
+static bool_t _edf;
+static uint32_t _jobs;
+static uint32_t _late;
+
+/**
+ * Periodic job: runs for its execution time (ticks advanced by the job itself)
+ * and sleeps up to the next release. Deadline = period.
+ * Releases stay on the period grid: a late job leaves the next one released already,
+ * and there is one job per release.
+ */
+static void
+periodic
+   (void)
+{
+   uint16_t id;
+   uint32_t next, end;
+
+   id = _next_id++;
+   if(_edf) thread_deadline(periods[id]);
+   else thread_priority(rm_prio[id]);
+   next = ticks;
+   while(ticks < EDF_TICKS) {                     // with a backlog, main may not run again.
+      end = ticks + _wcet[id];
+      while((int32_t)(ticks - end) < 0) port_tick(1);
+      next += periods[id];
+      _jobs++;
+      if((int32_t)(ticks - next) > 0) _late++;
+      thread_sleep(((int32_t)(next - ticks) > 0)? next - ticks : 1);   // a job ends by sleeping.
+   }
+}
+
+/**
+ * Runs a task set of the given utilization (in percent) with EDF or rate-monotonic priorities.
+ * @return Actual utilization of the task set, in thousandths.
+ */
+static uint16_t
+edf_run
+   (uint16_t pct,
+   bool_t edf)
+{
+   uint32_t u;
+   uint16_t i;
+
+   setup(EDF_TASKS);
+   _edf = edf;
+   _jobs = 0;
+   _late = 0;
+   edf_misses = 0;
+   u = 0;
+   for(i=0; i<EDF_TASKS; i++) {
+      _wcet[i] = (periods[i] * pct + 50 * EDF_TASKS) / (100 * EDF_TASKS);
+      if(_wcet[i] == 0) _wcet[i] = 1;
+      u += 1000 * _wcet[i] / periods[i];
+      thread_create(periodic, STACK);
+   }
+   while(os_count_threads()) {
+      scheduler();
+      if(os_count_ready() == 0) port_tick(1);
+   }
+   return (uint16_t)u;
+}
+
+/**
+ * Deadline misses with EDF and with rate-monotonic priorities, on stderr.
+ */
+static void
+edf_report
+   (void)
+{
+   uint16_t i, u;
+
+   fprintf(stderr, "policy,utilization,jobs,misses,kernel_misses\n");
+   for(i=0; i<sizeof(utilizations)/sizeof(utilizations[0]); i++) {
+      u = edf_run(utilizations[i], TRUE);
+      fprintf(stderr, "edf,%u,%u,%u,%u\n", u, _jobs, _late, edf_misses);
+      u = edf_run(utilizations[i], FALSE);
+      fprintf(stderr, "rm,%u,%u,%u,-\n", u, _jobs, _late);
+   }
+}
+
+#define ROUND_YIELDS            10
+static volatile uint32_t _turns;
+
+/**
+ * Thread without deadline at EDF_PRIO: each yield ends its round.
+ */
+static void
+round_yielder
+   (void)
+{
+   uint16_t i;
+
+   thread_priority(EDF_PRIO);
+   for(i=0; i<ROUND_YIELDS; i++) thread_yield();
+   expect(_turns >= ROUND_YIELDS / 2, "edf: lower priorities run when a thread without deadline yields");
+   _stop = TRUE;
+}
+
+/**
+ * Lower priority thread, counting its turns.
+ */
+static void
+round_low
+   (void)
+{
+   thread_priority(0);
+   while(!_stop) {
+      _turns++;
+      thread_yield();
+   }
+}
+
+/**
+ * Fixed priority rounds of the threads without deadline at EDF_PRIO.
+ */
+static void
+edf_round_check
+   (void)
+{
+   setup(2);
+   _turns = 0;
+   thread_create(round_low, STACK);
+   thread_create(round_yielder, STACK);
+   run_all();
+}
+#endif
+
+#ifdef CRONOS_IRQ_PROFILE
+/**
+ * Longest interrupt-disabled windows, on stderr.
+ */
+static void
+irq_report
+   (void)
+{
+   uint16_t i;
+
+   fprintf(stderr, "site,count,max_cycles,max_ns\n");
+   for(i=0; (i<IRQ_PROFILE_SITES) && (irq_profile[i].file != NULL); i++)
+      fprintf(stderr, "%s:%u,%u,%lu,%.1f\n", irq_profile[i].file, irq_profile[i].line, irq_profile[i].count,
+         (unsigned long)irq_profile[i].max, irq_profile[i].max / _cycles_ns);
+}
+#endif
+
+int
+main
+   (void)
+{
+   uint16_t i;
+#ifdef CRONOS_LOAD
+   uint16_t j;
+#endif
+
+   calibrate();
+   printf("bench,config,n,ops,cycles_per_op,ns_per_op\n");
+   for(i=0; i<sizeof(counts)/sizeof(counts[0]); i++) bench_yield(counts[i]);
+   fprintf(stderr, "waitq,n,buckets,used,longest\n");
+   for(i=0; i<sizeof(counts)/sizeof(counts[0]); i++) bench_signal(counts[i]);
+   for(i=0; i<sizeof(counts)/sizeof(counts[0]); i++) bench_task_yield(counts[i]);
+   for(i=0; i<sizeof(counts)/sizeof(counts[0]); i++) bench_task_signal(counts[i]);
+   for(i=0; i<sizeof(counts)/sizeof(counts[0]); i++) bench_isr(counts[i]);
+   for(i=0; i<sizeof(counts)/sizeof(counts[0]); i++) bench_queue(counts[i]);
+   for(i=0; i<sizeof(counts)/sizeof(counts[0]); i++) bench_lock(counts[i]);
+   for(i=0; i<sizeof(counts)/sizeof(counts[0]); i++) bench_contended(counts[i]);
+   for(i=0; i<sizeof(counts)/sizeof(counts[0]); i++) bench_callback(counts[i]);
+   for(i=0; i<sizeof(counts)/sizeof(counts[0]); i++) bench_callback_handle(counts[i]);
+   for(i=0; i<sizeof(counts)/sizeof(counts[0]); i++) bench_tick(counts[i]);
+   sem_check();
+   event_check();
+   queue_check();
+#ifdef CRONOS_IRQ_PROFILE
+   irq_report();
+#endif
+#ifdef CRONOS_EDF
+   edf_report();
+   edf_round_check();
+#endif
+   if(_failed) return 1;
+#ifdef CRONOS_LOAD
+   fprintf(stderr, "load_target,load,governor\n");
+   for(i=0; i<sizeof(loads)/sizeof(loads[0]); i++) {
+      for(j=0; (j<LOAD_TRIES) && !load_check(loads[i]); j++);
+      if(j == LOAD_TRIES) return 1;
+   }
+#endif
+   return 0;
+}
@@ -0,0 +1,321 @@
+/**
+ * @file latency.c
+ * @brief Wake latency of a high-priority thread behind a long computation (host build, "make bench").
+ *
+ * Each line of the output is a CSV record:
+ *    bench,config,n,ops,cycles_per_op,ns_per_op
+ * where n is the length of the computation in milliseconds. Built cooperative (bench_latency)
+ * and with CRONOS_PREEMPT (bench_preempt).
+ * With CRONOS_CLOCK, also the cost of clock_ns() and how late thread_sleep_ns ends, below
+ * and above one tick (n in microseconds); the exit status is 1 if a sleep ends early.
+ * A thread working for part of each period of PERIOD ticks drifts with thread_sleep and not
+ * with period_wait (drift per period, n = period in ticks); the release jitter of period_wait
+ * is printed on stderr, and the exit status is 1 if it drifts.
+ *
+ * @author Bruno Basseto (bruno@wise-ware.org)
+ * @version 0
+ */
+
+/********************************************************************************
+ ********************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 1995-2014 Bruno Basseto.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************
+ ********************************************************************************/
+
+#include <stdio.h>
+#include <time.h>
+#include "chronos.h"
+#include "config.h"
+#include "threads.h"
+
+#ifdef CRONOS_PREEMPT
+#define CONFIG                  "preempt"
+#else
+#define CONFIG                  "coop"
+#endif
+#define STACK                   16384             // the tick signal frame goes on the thread stack
+#define TICK_US                 1000              // real-time tick
+#define SAMPLES                 100
+
+static const uint16_t runs[] = { 5, 20 };          // computation between yields, in ms
+
+static double _cycles_ns;                         // cycles per nanosecond
+static uint32_t _run;                             // computation between yields, in cycles
+static volatile bool_t _stop;
+static uint64_t _sum;
+static word_t _max;
+#ifdef CRONOS_CLOCK
+static const uint16_t sleeps[] = { 20, 100, 1000, 15000, 30000 };  // in us, the last ones longer than a tick
+#define HR_TICK_US              10100             // tick of kernel_init(2560000): 101 timer counts of 100 us
+static uint16_t _us;
+static uint32_t _early;
+#define PERIOD                  3                 // ticks
+#define PERIODS                 200
+static kperiod_t _period;
+static bool_t _absolute;
+static bool_t _drifted;
+#endif
+
+/**
+ * Monotonic time in nanoseconds.
+ */
+static uint64_t
+now_ns
+   (void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Measures the cycle counter frequency.
+ */
+static void
+calibrate
+   (void)
+{
+   uint64_t t;
+   word_t c;
+
+   t = now_ns();
+   c = cycle_count();
+   while(now_ns() - t < 50000000ull);
+   _cycles_ns = (double)(cycle_count() - c) / (double)(now_ns() - t);
+}
+
+/**
+ * Low priority: long computations, yielding only between them.
+ */
+static void
+hog
+   (void)
+{
+   while(!_stop) {
+      delay(_run);
+      thread_yield();
+   }
+}
+
+/**
+ * High priority: sleeps for one tick and measures how long it took to run again.
+ */
+static void
+waker
+   (void)
+{
+   uint16_t i;
+   word_t c;
+
+   thread_priority(MAX_PRIO - 1);
+   for(i=0; i<SAMPLES; i++) {
+      c = cycle_count();
+      thread_sleep(1);
+      c = cycle_count() - c;
+      _sum += c;
+      if(c > _max) _max = c;
+   }
+   _stop = TRUE;
+}
+
+/**
+ * Prints a result line.
+ */
+static void
+report
+   (const char *bench,
+   uint16_t n,
+   uint64_t cycles,
+   uint32_t ops)
+{
+   double c;
+
+   c = (double)cycles / ops;
+   printf("%s,%s,%u,%u,%.1f,%.1f\n", bench, CONFIG, n, ops, c, c / _cycles_ns);
+   fflush(stdout);
+}
+
+/**
+ * One-tick sleep of a high-priority thread while a low-priority thread computes for ms.
+ */
+static void
+bench_wake
+   (uint16_t ms)
+{
+   kernel_init(2560000);
+   _run = (uint32_t)(ms * 1000000.0 * _cycles_ns);
+   _stop = FALSE;
+   _sum = 0;
+   _max = 0;
+   thread_create(hog, STACK);
+   thread_create(waker, STACK);
+   port_tick_start(TICK_US);
+   while(os_count_threads()) scheduler();
+   port_tick_stop();
+   report("wake_latency", ms, _sum, SAMPLES);
+   report("wake_latency_max", ms, _max, 1);
+}
+
+#ifdef CRONOS_CLOCK
+/**
+ * Cost of one clock_ns() read.
+ */
+static void
+bench_clock
+   (void)
+{
+   uint32_t i;
+   word_t c;
+
+   kernel_init(2560000);
+   c = cycle_count();
+   for(i=0; i<100000; i++) clock_ns();
+   report("clock_read", 1, cycle_count() - c, 100000);
+}
+
+/**
+ * Sleeps of _us microseconds, on the cycle counter compare.
+ */
+static void
+hr_sleeper
+   (void)
+{
+   uint16_t i;
+   uint64_t t, target;
+
+   target = ns_to_cycles(_us * 1000ull);
+   for(i=0; i<SAMPLES; i++) {
+      t = clock_cycles();
+      thread_sleep_ns(_us * 1000ull);
+      t = clock_cycles() - t;
+      if(t < target) {
+         _early++;
+         continue;
+      }
+      _sum += t - target;
+      if(t - target > _max) _max = t - target;
+   }
+}
+
+/**
+ * How late thread_sleep_ns ends, with nothing else to run and the real-time tick.
+ */
+static void
+bench_hr_sleep
+   (uint16_t us)
+{
+   kernel_init(2560000);
+   _us = us;
+   _sum = 0;
+   _max = 0;
+   thread_create(hr_sleeper, STACK);
+   port_tick_start(HR_TICK_US);
+   while(os_count_threads()) scheduler();
+   port_tick_stop();
+   report("hr_sleep_late", us, _sum, SAMPLES);
+   report("hr_sleep_late_max", us, _max, 1);
+}
+
+/**
+ * Works for 1.3 ms (more than one tick) in each period,
+ * released by thread_sleep (relative) or period_wait (absolute).
+ */
+static void
+periodic
+   (void)
+{
+   uint16_t i;
+
+   thread_priority(MAX_PRIO - 1);
+   period_init(&_period, PERIOD);
+   for(i=0; i<PERIODS; i++) {
+      delay((uint32_t)(1300000.0 * _cycles_ns));
+      if(_absolute) period_wait(&_period);
+      else thread_sleep(PERIOD);
+   }
+   _stop = TRUE;
+}
+
+/**
+ * Drift per period of a periodic thread, with a low priority thread computing in 100 us slices.
+ */
+static void
+bench_period
+   (bool_t absolute)
+{
+   uint64_t c;
+   uint32_t t;
+   uint16_t i;
+
+   kernel_init(2560000);
+   _run = (uint32_t)(100000.0 * _cycles_ns);
+   _absolute = absolute;
+   _stop = FALSE;
+   thread_create(hog, STACK);
+   thread_create(periodic, STACK);
+   port_tick_start(TICK_US);
+   t = ticks;
+   c = clock_cycles();
+   while(os_count_threads()) scheduler();
+   c = clock_cycles() - c;
+   t = ticks - t;
+   port_tick_stop();
+   c -= (uint64_t)((double)PERIODS * PERIOD * TICK_US * 1000.0 * _cycles_ns);
+   report(absolute? "period_drift_wait" : "period_drift_sleep", PERIOD, ((int64_t)c < 0)? 0 : c, PERIODS);
+   if(!absolute) return;
+
+   if((t < PERIODS * PERIOD) || (t > PERIODS * PERIOD + 2)) _drifted = TRUE;
+   fprintf(stderr, "period,releases,overruns,skipped,jitter_min_ns,jitter_max_ns,histogram_us\n");
+   fprintf(stderr, "%s,%u,%u,%u,%u,%u,", CONFIG, _period.releases, _period.overruns, _period.skipped,
+      _period.jitter_min, _period.jitter_max);
+   for(i=0; i<PERIOD_HIST; i++) fprintf(stderr, "%s%u", i? "/" : "", _period.hist[i]);
+   fprintf(stderr, "\n");
+}
+#endif
+
+int
+main
+   (void)
+{
+   uint16_t i;
+
+   calibrate();
+   printf("bench,config,n,ops,cycles_per_op,ns_per_op\n");
+   for(i=0; i<sizeof(runs)/sizeof(runs[0]); i++) bench_wake(runs[i]);
+#ifdef CRONOS_CLOCK
+   bench_clock();
+   for(i=0; i<sizeof(sleeps)/sizeof(sleeps[0]); i++) bench_hr_sleep(sleeps[i]);
+   if(_early) {
+      fprintf(stderr, "hr_sleep: %u sleeps ended early\n", _early);
+      return 1;
+   }
+   bench_period(FALSE);
+   bench_period(TRUE);
+   if(_drifted) {
+      fprintf(stderr, "period_wait: drift\n");
+      return 1;
+   }
+#endif
+   return 0;
+}
@@ -0,0 +1,154 @@
+/**
+ * @file scaling.c
+ * @brief Multi-core scaling benchmark (host build, "make bench", CRONOS_CORES > 1).
+ *
+ * Each line of the output is a CSV record:
+ *    bench,config,n,ops,cycles_per_op,ns_per_op
+ * where n is the number of cores running the scheduler.
+ *
+ * @author Bruno Basseto (bruno@wise-ware.org)
+ * @version 0
+ */
+
+/********************************************************************************
+ ********************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 1995-2014 Bruno Basseto.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************
+ ********************************************************************************/
+
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+#include "chronos.h"
+#include "config.h"
+#include "threads.h"
+
+#define CONFIG                  "smp"
+#define STACK                   8192
+#define THREADS                 64                // threads in the test, all created on core 0
+#define OPS                     200000            // thread_yield calls, approximately
+
+static const uint32_t works[] = { 0, 1000, 10000 };
+
+static double _cycles_ns;                         // cycles per nanosecond
+static uint32_t _iter;                            // iterations per thread
+static uint32_t _work;                            // busy loop between yields
+static volatile uint32_t _done;                   // threads finished
+
+/**
+ * Monotonic time in nanoseconds.
+ */
+static uint64_t
+now_ns
+   (void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Measures the cycle counter frequency.
+ */
+static void
+calibrate
+   (void)
+{
+   uint64_t t;
+   word_t c;
+
+   t = now_ns();
+   c = cycle_count();
+   while(now_ns() - t < 50000000ull);
+   _cycles_ns = (double)(cycle_count() - c) / (double)(now_ns() - t);
+}
+
+/**
+ * Thread: some work, then yield.
+ */
+static void
+worker
+   (void)
+{
+   uint32_t i, k;
+
+   for(i=0; i<_iter; i++) {
+      for(k=0; k<_work; k++) asm volatile("");
+      thread_yield();
+   }
+   __sync_fetch_and_add(&_done, 1);
+}
+
+/**
+ * Main loop of each core.
+ */
+static void
+core_main
+   (void)
+{
+   while(_done < THREADS) scheduler();
+}
+
+/**
+ * THREADS threads yielding, scheduled by n cores.
+ */
+static void
+bench_scaling
+   (uint16_t n,
+   uint32_t work)
+{
+   char name[32];
+   uint64_t t;
+   uint32_t ops;
+   uint16_t i;
+
+   kernel_init(2560000);
+   _work = work;
+   _iter = OPS / THREADS;
+   _done = 0;
+   for(i=0; i<THREADS; i++) thread_create(worker, STACK);
+   t = now_ns();
+   port_cores_run(n, core_main);
+   t = now_ns() - t;
+   ops = THREADS * _iter;
+   snprintf(name, sizeof(name), "scaling_work%u", work);
+   printf("%s,%s,%u,%u,%.1f,%.1f\n", name, CONFIG, n, ops, t * _cycles_ns / ops, (double)t / ops);
+   fflush(stdout);
+}
+
+int
+main
+   (void)
+{
+   uint16_t n;
+   uint32_t i;
+
+   calibrate();
+   printf("bench,config,n,ops,cycles_per_op,ns_per_op\n");
+   fprintf(stderr, "scaling: %ld processors online\n", sysconf(_SC_NPROCESSORS_ONLN));
+   for(i=0; i<sizeof(works)/sizeof(works[0]); i++) {
+      for(n=1; n<=CRONOS_CORES; n*=2) bench_scaling(n, works[i]);
+   }
+   return 0;
+}
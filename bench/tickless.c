@@ -0,0 +1,224 @@
+/**
+ * @file tickless.c
+ * @brief Timer expirations in tickless mode, on the simulated timer (host build, "make bench").
+ *
+ * Built with CRONOS_TICKLESS (bench_tickless), in virtual time: the idle processor jumps
+ * to the next deadline, and port_wake() wakes it earlier from another interrupt source.
+ * Threads and callbacks sleep for mixed durations, and each expiration is checked against
+ * the expected tick; a thread woken by the simulated interrupt checks that the tick counter
+ * caught up with the timer counts elapsed. The number of timer interrupts (_sim_irqs) is
+ * checked against the expirations and wakeups. Each callback also fires another one with
+ * time 0, which must run at the same tick instead of waiting for the next deadline.
+ * Results on stderr; the exit status is 1 on a lost, late or early expiration.
+ *
+ * @author Bruno Basseto (bruno@wise-ware.org)
+ * @version 0
+ */
+
+/********************************************************************************
+ ********************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 1995-2014 Bruno Basseto.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************
+ ********************************************************************************/
+
+#include <stdio.h>
+#include "chronos.h"
+#include "config.h"
+#include "threads.h"
+#include "timer.h"
+
+#ifndef CRONOS_TICKLESS
+#error "tickless.c: build with CRONOS_TICKLESS"
+#endif
+
+#define STACK                   8192
+#define ROUNDS                  20                // sleeps per thread or callback
+#define WAKES                   50                // simulated interrupts
+#define TICK_COUNTS             ((uint32_t)_tick_period + 1)
+#define MAX_SPAN                (TIMER_MAX / TICK_COUNTS)
+
+static const uint16_t sleeps[] = { 1, 2, 5, 13, 64, 700, 1500 };     // thread sleeps, in ticks
+static const uint16_t delays[] = { 3, 17, 250, 1000 };                // callback periods, in ticks
+
+typedef struct {
+   callback_t *cb;
+   uint16_t delay;
+   uint32_t due;
+   uint16_t round;
+} timed_t;
+
+static timed_t _timed[sizeof(delays)/sizeof(delays[0])];
+static volatile uint16_t _next_id;
+static byte_t _wake_obj;
+static uint32_t _counts;                          // timer counts elapsed, as seen by the waker
+static uint32_t _expired;
+static uint32_t _chained;                         // callbacks fired with time 0 run
+static uint32_t _chained_due;
+static uint32_t _woken;
+static uint32_t _errors;
+
+/**
+ * Timer counts elapsed since kernel_init.
+ * Valid while a thread runs: the timer is never stretched then.
+ */
+static uint32_t
+counts_now
+   (void)
+{
+   return ticks * TICK_COUNTS + (uint32_t)TMRx;
+}
+
+/**
+ * Compares an expiration with the expected tick.
+ */
+static void
+check
+   (const char *what,
+   uint32_t n,
+   uint32_t expected)
+{
+   if(ticks == expected) return;
+   fprintf(stderr, "tickless: %s %u expired at tick %u, expected %u\n", what, n, ticks, expected);
+   _errors++;
+}
+
+/**
+ * Thread sleeping ROUNDS times for its duration, with absolute deadlines.
+ */
+static void
+sleeper
+   (void)
+{
+   uint32_t due;
+   uint16_t i, d;
+
+   d = sleeps[_next_id++];
+   due = ticks;
+   for(i=0; i<ROUNDS; i++) {
+      due += d;
+      thread_sleep_until(due);
+      check("sleep", d, due);
+      _expired++;
+   }
+}
+
+/**
+ * Callback fired with time 0 by another callback.
+ */
+static void
+chained
+   (void *par)
+{
+   check("chained callback", 0, _chained_due);
+   _chained++;
+}
+
+/**
+ * Callback rescheduling itself ROUNDS times for its delay.
+ */
+static void
+timed
+   (timed_t *t)
+{
+   check("callback", t->delay, t->due);
+   _expired++;
+   _chained_due = ticks;
+   callback_fire(chained, NULL, 0);
+   if(++t->round == ROUNDS) return;
+   t->due += t->delay;
+   callback_schedule(t->cb, t->delay);
+}
+
+/**
+ * Simulated interrupt handler.
+ */
+static void
+wake_isr
+   (void)
+{
+   thread_signal_from_isr(&_wake_obj);
+}
+
+/**
+ * Thread woken WAKES times by the simulated interrupt, at pseudo-random timer counts.
+ * The tick counter must account the whole ticks elapsed in the stretched period.
+ */
+static void
+waker
+   (void)
+{
+   uint32_t seed, n;
+   uint16_t i;
+
+   seed = 1;
+   for(i=0; i<WAKES; i++) {
+      seed = seed * 1103515245 + 12345;
+      n = (seed >> 8) % (MAX_SPAN * TICK_COUNTS);
+      _counts = counts_now() + n;
+      port_wake(n, wake_isr);
+      thread_wait(&_wake_obj);
+      check("wake", n, _counts / TICK_COUNTS);
+      _woken++;
+   }
+}
+
+int
+main
+   (void)
+{
+   uint32_t limit;
+   uint16_t i;
+
+   kernel_init(2560000);
+   for(i=0; i<sizeof(sleeps)/sizeof(sleeps[0]); i++) thread_create(sleeper, STACK);
+   for(i=0; i<sizeof(delays)/sizeof(delays[0]); i++) {
+      _timed[i].cb = callback_create(timed, &_timed[i]);
+      _timed[i].delay = delays[i];
+      _timed[i].due = ticks + delays[i];
+      callback_schedule(_timed[i].cb, delays[i]);
+   }
+   thread_create(waker, STACK);
+   while(os_count_threads() || os_count_callbacks()) scheduler();
+
+   /*
+    * Each timer interrupt ends a stretched period: at an expiration, or at the longest
+    * span after the last wakeup.
+    */
+   limit = _expired + _woken + ticks / MAX_SPAN + 1;
+   fprintf(stderr, "tickless: %u ticks, %u timer interrupts (limit %u), %u expirations, %u wakeups\n",
+      ticks, _sim_irqs, limit, _expired, _woken);
+   if(_expired != ROUNDS * (sizeof(sleeps)/sizeof(sleeps[0]) + sizeof(delays)/sizeof(delays[0]))) {
+      fprintf(stderr, "tickless: %u expirations lost\n",
+         ROUNDS * (uint32_t)(sizeof(sleeps)/sizeof(sleeps[0]) + sizeof(delays)/sizeof(delays[0])) - _expired);
+      _errors++;
+   }
+   if(_chained != _expired - ROUNDS * sizeof(sleeps)/sizeof(sleeps[0])) {
+      fprintf(stderr, "tickless: %u chained callbacks lost\n", _expired - ROUNDS * (uint32_t)(sizeof(sleeps)/sizeof(sleeps[0])) - _chained);
+      _errors++;
+   }
+   if(_sim_irqs > limit) {
+      fprintf(stderr, "tickless: timer not stretched\n");
+      _errors++;
+   }
+   return _errors? 1 : 0;
+}
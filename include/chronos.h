@@ -10,22 +10,9 @@ typedef enum {
    FALSE,
    TRUE
 } bool_t;
-#define byte_t unsigned char
-#define int8_t char
-#define uint8_t char
-
+#include "port.h"
 #include "list.h"
 
-#define disable() asm volatile ("di");
-#define enable()  asm volatile ("ei");
-#define word_t unsigned int
-#define uint32_t unsigned int
-#define uint16_t unsigned short
-#define int32_t int
-#define int16_t short
-
-#define __interrupt __attribute__((interrupt))
-
 typedef union {
    uint32_t d;
    uint16_t w[2];
@@ -51,6 +38,30 @@ typedef union {
 #define buffer_t        byte_t *
 #define string_t        char *
 
+/**
+ * Temporizador do kernel (elemento da lista delta).
+ */
+typedef struct {
+   void *next;                                     ///< Prximo temporizador a expirar.
+   void *prev;                                     ///< Temporizador anterior.
+   word_t delta;                                   ///< Ticks aps a expirao do temporizador anterior (TIMER_HR: instante em ciclos).
+   byte_t type;                                    ///< Dono do temporizador (TIMER_THREAD ou TIMER_CALLBACK).
+   byte_t active;                                  ///< Temporizador presente na lista delta (TRUE) ou na lista do comparador (TIMER_HR).
+} ktimer_t;
+
+#define TIMER_THREAD            0
+#define TIMER_CALLBACK          1
+#define TIMER_HR                2                 ///< ktimer_t.active: esperando o comparador do COUNT.
+
+/**
+ * Contabilizao de tempo de CPU (em ciclos da fonte CYCLE_CLOCK).
+ */
+typedef struct {
+   uint64_t cycles;                                ///< Total de ciclos executados.
+   uint32_t runs;                                  ///< Nmero de execues.
+   uint32_t max;                                   ///< Execuo mais longa.
+} cpu_stats_t;
+
 /**
  * estrutura de controle dos threads
  */
@@ -63,22 +74,99 @@ typedef struct {
          bit(f_waiting);                           ///< [bit 2] espera um sinal
          bit(f_semaphore);                         ///< [bit 3] espera um semforo
          bit(f_suspend);                           ///< [bit 4] thread suspenso
-         bit( );                                   ///  [bit 5] no utilizado
+         bit(f_queued);                            ///< [bit 5] thread presente em uma fila do escalador
          bit(f_timeout);                           ///< [bit 6] valor de retorno (timeout)
          bit(f_terminate);                         ///< [bit 7] requisio de trmino
-         unsigned prio:3;                          ///< [bits 8-10] prioridade do thread
+         unsigned prio:5;                          ///< [bits 8-12] prioridade do thread
+         bit(f_pi);                                ///< [bit 13] espera um mutex com dono (kmutex_t)
+         bit(f_static);                            ///< [bit 14] TCB e stack fornecidos pela aplicao
+         bit(f_task);                              ///< [bit 15] tarefa sem stack (task_create)
       };
       uint16_t flags;
    };
    word_t data;                                    ///< Identificao de sinal ou semforo
-   word_t sp0;                                     ///< Valor inicial do stack-pointer
-   word_t sp;                                      ///< Stack-pointer corrente
-   word_t timer;                                   ///< contador de tempo de espera
+   union {
+      word_t sp0;                                  ///< Valor inicial do stack-pointer
+      word_t lc;                                   ///< Ponto de continuao da tarefa (TASK_xxx)
+   };
+   union {
+      word_t sp;                                   ///< Stack-pointer corrente
+      void (*task)(void *);                        ///< Funo da tarefa
+   };
+   uint16_t stack_size;                            ///< Tamanho do stack (bytes, a partir de sp0)
+   ktimer_t timer;                                 ///< Temporizador de espera
+   void *mutexes;                                  ///< Lista de mutexes (kmutex_t) travados pelo thread
+   byte_t base_prio;                               ///< Prioridade prpria, sem herana
+   byte_t ev_mode;                                 ///< Modo de espera de eventos (EV_xxx)
+   uint32_t ev_mask;                               ///< Eventos esperados / recebidos
+   void *msg;                                      ///< Mensagem em trnsito (filas)
+   byte_t core;                                    ///< Ncleo em cujas filas est o thread
+   byte_t released;                                ///< Job EDF em andamento
+   word_t rel_deadline;                            ///< Prazo relativo (ticks, 0 = sem prazo)
+   uint32_t deadline;                              ///< Prazo absoluto do job corrente
+   uint16_t misses;                                ///< Prazos perdidos
+   cpu_stats_t cpu;                                ///< Tempo de CPU utilizado
 } thread_t;
 
 #define mutex_t            byte_t
 extern volatile uint32_t ticks;
 
+/**
+ * Mutex com dono, herana de prioridade e travamento recursivo opcional.
+ */
+typedef struct {
+   list_item_t list;                               ///< Lista de mutexes do dono.
+   thread_t *owner;                                ///< Thread dono (NULL = livre).
+   uint16_t count;                                 ///< Nmero de travamentos pelo dono.
+   bool_t recursive;                               ///< Permite travamento recursivo.
+} kmutex_t;
+
+/**
+ * Semforo contador.
+ */
+typedef struct {
+   word_t count;                                   ///< Unidades disponveis.
+   word_t max;                                     ///< Contagem mxima (0 = sem limite).
+} ksem_t;
+
+/**
+ * Grupo de 32 flags de eventos.
+ */
+typedef struct {
+   uint32_t flags;                                 ///< Flags sinalizados.
+} kevent_t;
+
+/**
+ * Fila de mensagens (ponteiros, sem cpia). Uma caixa postal  uma fila de tamanho 1.
+ */
+typedef struct {
+   void **buf;                                     ///< Buffer circular de mensagens.
+   uint16_t size;                                  ///< Capacidade.
+   uint16_t head;                                  ///< Mensagem mais antiga.
+   volatile uint16_t count;                        ///< Mensagens na fila.
+   volatile word_t reserved;                       ///< Posies reservadas por interrupes.
+} kqueue_t;
+
+/**
+ * Liberaes peridicas de um thread em instantes absolutos (period_wait), sem deriva,
+ * com a estatstica do atraso da liberao at a execuo (jitter).
+ */
+#define PERIOD_HIST             16                ///< Faixas do histograma: 0 = abaixo de 1 us, i = abaixo de 2^i us.
+typedef struct {
+   uint32_t release;                               ///< ltima liberao (ticks).
+   word_t period;                                  ///< Perodo (ticks).
+   uint32_t releases;                              ///< Liberaes no prazo.
+   uint32_t overruns;                              ///< Execues terminadas depois da liberao seguinte.
+   uint32_t skipped;                               ///< Liberaes perdidas nos atrasos.
+   uint32_t jitter_min;                            ///< Menor atraso da liberao at a execuo (ns).
+   uint32_t jitter_max;                            ///< Maior atraso da liberao at a execuo (ns).
+   uint32_t hist[PERIOD_HIST];                     ///< Histograma dos atrasos.
+} kperiod_t;
+
+#define EV_ANY                  0                 ///< Espera qualquer um dos flags.
+#define EV_ALL                  1                 ///< Espera todos os flags.
+#define EV_CLEAR                2                 ///< Consome os flags recebidos.
+
 // --------
 // Servios
 // --------
@@ -89,7 +177,15 @@ extern volatile uint32_t ticks;
 #define SV_SIGNAL               4
 #define SV_LOCK                 5
 #define SV_UNLOCK               6
+#define SV_MLOCK                7
 #define SV_END                  9
+#define SV_SEMWAIT              10
+#define SV_EVWAIT               11
+#define SV_QSEND                12
+#define SV_QRECV                13
+#define SV_HRSLEEP              14
+#define SV_HRTIMEOUT            15
+#define SV_SLEEPUNTIL           16
 
 // ---------
 // callbacks
@@ -98,9 +194,78 @@ typedef struct {
    list_item_t list;
    void *function;                                 ///< Funo a ser acionada.
    void *param;                                    ///< Parmetro para a funo.
-   word_t timer;                                   ///< Tempo de acionamento.
+   ktimer_t timer;                                 ///< Temporizador de acionamento.
+   byte_t is_static;                               ///< Bloco fornecido pela aplicao (callback_fire_static).
+   byte_t queued;                                  ///< Presente na fila de callbacks prontos.
+   byte_t autofree;                                ///< Liberado aps a chamada (callback_fire).
+   byte_t running;                                 ///< Em execuo: callback_delete() espera o fim da chamada.
+   cpu_stats_t cpu;                                ///< Tempo de CPU (callback_create e callback_fire_static).
 } callback_t;
 extern volatile callback_t *_callbacks;
+extern cpu_stats_t callback_cpu;
+
+// --------------------------
+// pools de objetos do kernel
+// --------------------------
+typedef struct {
+   void *free;                                     ///< Lista de blocos livres.
+   word_t block;                                   ///< Tamanho de cada bloco.
+   uint16_t size;                                  ///< Nmero de blocos (0 = usa malloc).
+   uint16_t used;                                  ///< Blocos em uso.
+   uint16_t peak;                                  ///< Mximo de blocos em uso.
+} pool_t;
+extern pool_t thread_pool;
+extern pool_t callback_pool;
+#define pool_used(P)          ((P)->used)
+#define pool_peak(P)          ((P)->peak)
+
+// ------------------
+// trace do escalador
+// ------------------
+/**
+ * Registro binrio de trace (16 bytes, little-endian).
+ */
+typedef struct {
+   uint32_t time;                                  ///< Instante do evento (CYCLE_CLOCK).
+   uint32_t thread;                                ///< Thread envolvido (endereo do thread_t, 0 = main).
+   uint32_t object;                                ///< Objeto, funo ou argumento do evento.
+   byte_t event;                                   ///< Tipo do evento (TRACE_xxx).
+   byte_t reserved[3];
+} trace_rec_t;
+
+#define TRACE_SWITCH            1                 ///< main -> thread.
+#define TRACE_RETURN            2                 ///< thread -> main (object = servio).
+#define TRACE_IDLE              3                 ///< nenhum thread pronto.
+#define TRACE_SIGNAL            4                 ///< thread_signal (object = sinal).
+#define TRACE_UNLOCK            5                 ///< thread_unlock/mutex_unlock (object = mutex).
+#define TRACE_CB_FIRE           6                 ///< callback agendado (object = funo).
+#define TRACE_CB_RUN            7                 ///< incio de callback (object = funo).
+#define TRACE_CB_END            8                 ///< fim de callback (object = funo).
+#define TRACE_TICK              9                 ///< os_tick (object = ticks decorridos).
+#define TRACE_PREEMPT           10                ///< thread -> main pelo tick (CRONOS_PREEMPT).
+#define TRACE_SERVICE           16                ///< kernel_call (16 + servio, object = argumento).
+
+#define TRACE_MAGIC             0x43525443        ///< "CTRC"
+extern trace_rec_t trace_buffer[];
+extern volatile uint32_t trace_head;
+void trace_dump(void (*out)(void *data, word_t len));
+
+// -----------------------------------------------
+// perfil de sees com interrupes desabilitadas
+// -----------------------------------------------
+/**
+ * Maior janela com interrupes desabilitadas de um ponto do cdigo (CRONOS_IRQ_PROFILE).
+ */
+typedef struct {
+   const char *file;                               ///< Arquivo do disable()/critical_enter() (NULL = livre).
+   uint16_t line;                                  ///< Linha.
+   uint32_t count;                                 ///< Nmero de janelas medidas.
+   word_t max;                                     ///< Janela mais longa (ciclos de CYCLE_CLOCK).
+} irq_site_t;
+extern irq_site_t irq_profile[];
+void irq_profile_begin(const char *file, uint16_t line);
+void irq_profile_end(void);
+void irq_profile_reset(void);
 
 #define unreachable()         for(;;)
 
@@ -108,28 +273,142 @@ extern volatile callback_t *_callbacks;
 // cronos API
 // ----------
 void delay(uint32_t cycles);
+word_t cycle_count(void);
 void kernel_init(uint32_t pclock);
 #define kernel_run()                for(;;) { scheduler(); }
 thread_t *thread_create(void (*thr)(void), uint16_t stack_size);
+thread_t *thread_create_static(thread_t *th, void (*thr)(void), void *stack, uint16_t stack_size);
 void thread_priority(uint8_t prio);
 void thread_kill(thread_t *th);
 void thread_terminate(thread_t *th);
 void thread_suspend(thread_t *th);
 void thread_release(thread_t *th);
+callback_t *callback_create(void *fn, void *par);
+void callback_schedule(callback_t *cb, word_t time);
+void callback_stop(callback_t *cb);
+void callback_delete(callback_t *cb);
 void callback_fire(void *fn, void *par, word_t time);
 void callback_refire(void *fn, void *par, word_t time);
 void callback_cancel(void *fn);
+void callback_fire_static(callback_t *cb, void *fn, void *par, word_t time);
+void callback_cancel_static(callback_t *cb);
+bool_t callback_fire_from_isr(void *fn, void *par, word_t time);
+bool_t callback_schedule_from_isr(callback_t *cb, word_t time);
 void scheduler(void);
 void thread_signal(void *ptr);
+bool_t thread_signal_from_isr(void *ptr);
+extern volatile word_t isr_overruns;
 void thread_force(thread_t *th);
 void thread_unlock(void *ptr);
 bool_t kernel_call(uint16_t func, word_t arg);
+thread_t *task_create(void (*fn)(void *));
+thread_t *task_create_static(thread_t *th, void (*fn)(void *));
+bool_t task_call(uint16_t func, word_t arg);
 bool_t thread_not_terminated(void);
 bool_t thread_is_running(thread_t *th);
+uint16_t thread_stack_usage(thread_t *th);
+uint16_t os_count_threads(void);
+uint16_t os_count_callbacks(void);
+uint16_t os_count_ready(void);
+#define thread_cpu(T)               (&(T)->cpu)
+#define callback_cpu_stats(C)       (&(C)->cpu)
+void cpu_stats_reset(cpu_stats_t *s);
+void stack_overflow(thread_t *th);
+void idle_hook(void);
+void thread_deadline(word_t rel);
+extern uint32_t edf_misses;
+#define thread_misses(T)            ((T)->misses)
+extern cpu_stats_t idle_cpu;
+uint16_t cpu_load(void);
+void cpu_governor(void (*fn)(uint16_t load));
+extern uint32_t clock_hz;
+uint64_t clock_cycles(void);
+uint64_t clock_ns(void);
+uint64_t cycles_to_ns(uint64_t cycles);
+uint64_t ns_to_cycles(uint64_t ns);
+bool_t thread_sleep_cycles(word_t cycles);
+bool_t thread_sleep_ns(uint64_t ns);
+bool_t thread_set_timeout_cycles(word_t cycles);
+bool_t thread_set_timeout_ns(uint64_t ns);
+void period_init(kperiod_t *p, word_t period);
+bool_t period_wait(kperiod_t *p);
+void period_stats_reset(kperiod_t *p);
+void mutex_init(kmutex_t *m, bool_t recursive);
+bool_t mutex_trylock(kmutex_t *m);
+void mutex_unlock(kmutex_t *m);
+void sem_init(ksem_t *s, word_t count, word_t max);
+bool_t sem_trywait(ksem_t *s);
+bool_t sem_post(ksem_t *s);
+void event_init(kevent_t *e, uint32_t flags);
+uint32_t event_wait(kevent_t *e, uint32_t mask, byte_t mode);
+void event_post(kevent_t *e, uint32_t flags);
+void event_clear(kevent_t *e, uint32_t flags);
+void queue_init(kqueue_t *q, void **buf, uint16_t size);
+bool_t queue_send(kqueue_t *q, void *msg);
+bool_t queue_receive(kqueue_t *q, void **msg);
+bool_t queue_trysend(kqueue_t *q, void *msg);
+bool_t queue_tryreceive(kqueue_t *q, void **msg);
+#define queue_count(Q)              ((Q)->count)
+bool_t queue_send_from_isr(kqueue_t *q, void *msg);
+bool_t sem_post_from_isr(ksem_t *s);
+bool_t event_post_from_isr(kevent_t *e, uint32_t flags);
 #define thread_yield()              kernel_call(SV_YIELD, 0)
 #define thread_sleep(X)             kernel_call(SV_SLEEP, X)
+#define thread_sleep_until(X)       kernel_call(SV_SLEEPUNTIL, X)
 #define thread_set_timeout(X)       kernel_call(SV_SETTIMEOUT, X)
 #define thread_wait(X)              kernel_call(SV_WAIT, (word_t)X)
 #define thread_lock(X)              kernel_call(SV_LOCK, (word_t)X)
+#define mutex_lock(X)               kernel_call(SV_MLOCK, (word_t)X)
+#define sem_wait(X)                 kernel_call(SV_SEMWAIT, (word_t)X)
 #define thread_end()                kernel_call(SV_END, 0)
+
+/**
+ * Declara o bloco de controle e o stack de um thread esttico (sem uso do heap).
+ * O thread  iniciado com CHRONOS_THREAD_START(NAME, funo).
+ */
+#define CHRONOS_THREAD_DEFINE(NAME,SIZE)                             \
+   thread_t NAME;                                                    \
+   word_t NAME##_stack[((SIZE)+sizeof(word_t)-1)/sizeof(word_t)]
+#define CHRONOS_THREAD_START(NAME,FN)                                \
+   thread_create_static(&NAME, FN, NAME##_stack, sizeof(NAME##_stack))
+
+/**
+ * Tarefas sem stack: executadas no stack do main(), pelo escalador e nas mesmas filas dos threads.
+ * A funo da tarefa recebe o seu bloco de controle, que pode ser o incio de uma estrutura
+ * da aplicao (task_create_static). Variveis locais no so preservadas entre as esperas;
+ * as tarefas no podem chamar kernel_call() nem as macros thread_xxx. No mximo uma espera
+ * (TASK_YIELD, TASK_SLEEP, ...) por linha do cdigo fonte.
+ *    typedef struct { thread_t th; int pin; } led_t;
+ *    void blink(void *p) {
+ *       led_t *t = p;
+ *       TASK_BEGIN(t);
+ *       for(;;) {
+ *          TASK_SLEEP(t, 1000);
+ *          led_toggle(t->pin);
+ *       }
+ *       TASK_END(t);
+ *    }
+ * Uma funo de tarefa que retorna sem esperar cede a vez (como TASK_YIELD).
+ */
+#define TASK_BEGIN(T)               switch(((thread_t *)(T))->lc) { case 0:
+#define TASK_END(T)                 } task_call(SV_END, 0)
+#define TASK_YIELD(T)               do { ((thread_t *)(T))->lc = __LINE__; return; case __LINE__:; } while(0)
+#define TASK_CALL(T,F,X)            do { ((thread_t *)(T))->lc = __LINE__; if(task_call((F), (word_t)(X))) return; case __LINE__:; } while(0)
+#define TASK_SLEEP(T,X)             TASK_CALL(T, SV_SLEEP, X)
+#define TASK_SLEEP_UNTIL(T,X)       TASK_CALL(T, SV_SLEEPUNTIL, X)
+#define TASK_SET_TIMEOUT(T,X)       task_call(SV_SETTIMEOUT, X)
+#define TASK_WAIT(T,X)              TASK_CALL(T, SV_WAIT, X)
+#define TASK_LOCK(T,X)              TASK_CALL(T, SV_LOCK, X)
+#define TASK_SEM_WAIT(T,X)          TASK_CALL(T, SV_SEMWAIT, X)
+#define TASK_TIMEOUT(T)             (((thread_t *)(T))->f_timeout)
+
+/**
+ * Declara uma fila de mensagens e seu buffer, iniciada com CHRONOS_QUEUE_INIT(NAME).
+ */
+#define CHRONOS_QUEUE_DEFINE(NAME,SIZE)                              \
+   kqueue_t NAME;                                                    \
+   void *NAME##_buf[SIZE]
+#define CHRONOS_MAILBOX_DEFINE(NAME)  CHRONOS_QUEUE_DEFINE(NAME,1)
+#define CHRONOS_QUEUE_INIT(NAME)                                     \
+   queue_init(&NAME, NAME##_buf, sizeof(NAME##_buf)/sizeof(void *))
 #endif
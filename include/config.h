@@ -5,8 +5,60 @@
 // ----------------------
 // Configurao do Cronos
 // ----------------------
-#define CRONOS_TIMER             2   // Timer 2
+#ifdef CRONOS_HOST
+#define CRONOS_TIMER             0   // processo Linux: timer simulado (port_tick)
+#else
+#define CRONOS_TIMER             2   // Timer 2 (0 = timer simulado)
+#endif
 #define MAX_PRIO                 3
+#ifndef CRONOS_CORES
+#define CRONOS_CORES             1   // ncleos com escalador prprio (> 1 somente no host)
+#endif
+//#define CRONOS_TICKLESS            // programa o timer para o prximo prazo quando ocioso
+#define CRONOS_HANDOFF               // troca direta entre threads, sem passar por main()
+//#define CRONOS_PREEMPT             // o tick toma a CPU do thread corrente (no host, o sinal usa o stack do thread)
+                                     // o kernel usa o heap com interrupes desabilitadas; a aplicao precisa de uma libc reentrante
+#define PREEMPT_QUANTUM          { 2, 2, 2 }   // fatia de tempo de cada prioridade (ticks)
+#define ISR_QUEUE_SIZE           16  // eventos pendentes de interrupes (potncia de 2)
+#ifndef POOL_THREADS
+#define POOL_THREADS             8   // blocos de controle de threads pr-alocados (0 = malloc)
+#endif
+#ifndef WAITQ_SIZE
+#if POOL_THREADS > 256
+#define WAITQ_SIZE               1024 // filas de espera por objeto (potncia de 2, da ordem de POOL_THREADS)
+#elif POOL_THREADS > 64
+#define WAITQ_SIZE               256
+#elif POOL_THREADS > 16
+#define WAITQ_SIZE               64
+#else
+#define WAITQ_SIZE               16
+#endif
+#endif
+#ifndef POOL_CALLBACKS
+#define POOL_CALLBACKS           16  // callbacks pr-alocados (0 = malloc)
+#endif
+#define STACK_PATTERN            0xa5a5a5a5  // padro de preenchimento dos stacks
+//#define CRONOS_STACK_CHECK         // verifica a palavra de guarda do stack a cada troca de contexto
+#define CRONOS_ACCOUNTING            // contabiliza os ciclos de CPU de threads e callbacks
+#define CRONOS_LOAD                  // mede a carga da CPU (tempo ocioso do ncleo 0)
+#ifndef LOAD_PERIOD
+#define LOAD_PERIOD              10  // ticks por perodo de medida da carga (100 ms)
+#endif
+#define LOAD_WINDOW              8   // perodos na mdia mvel da carga
+//#define CRONOS_EDF                 // classe EDF (earliest deadline first) na prioridade EDF_PRIO
+#define EDF_PRIO                 1   // prioridade dos threads com prazo (thread_deadline)
+//#define CRONOS_IDLE_WAIT           // idle_hook() padro espera a prxima interrupo (IDLE_WAIT)
+#define CYCLE_CLOCK()            cycle_count()   // fonte de ciclos (registrador COUNT do CP0)
+#define CRONOS_CLOCK                 // relgio monotnico de 64 bits e esperas abaixo de um tick (comparador do COUNT)
+#ifdef CRONOS_HOST
+#define CYCLE_HZ                 0   // frequncia de cycle_count() (0 = medida por kernel_init)
+#else
+#define CYCLE_HZ                 40000000    // frequncia de cycle_count() (COUNT = SYSCLK / 2)
+#endif
+//#define CRONOS_TRACE               // registra eventos do escalador em trace_buffer
+#define TRACE_SIZE               256 // registros no buffer de trace (potncia de 2)
+//#define CRONOS_IRQ_PROFILE         // mede a maior janela com interrupes desabilitadas por ponto do cdigo
+#define IRQ_PROFILE_SITES        32  // pontos registrados pelo perfil de interrupes
 
 // ------------------
 // network interfaces
@@ -13,11 +13,13 @@ typedef struct {
 
 void list_add(void *list, void *item);
 void list_push(void *list, void *item);
+void list_insert(void *list, void *pos, void *item);
 void list_remove(void *list, void *item);
 void *list_pop(void *list);
-bool_t list_contains(void *list, void *item);
+bool_t list_contains(volatile void *list, void *item);
+uint16_t list_length(volatile void *list);
 
-#define list_for_each(X, Y)   for(Y=X;Y!=NULL;Y=Y->list.next)
+#define list_for_each(X, Y)   for(Y=(void *)(X);Y!=NULL;Y=Y->list.next)
 #define for_each(ARRAY, PTR)  for(PTR=ARRAY; ((word_t)(PTR)-(word_t)(ARRAY))<sizeof(ARRAY); PTR++)
 
 #endif
@@ -0,0 +1,141 @@
+/**
+ * @file port.h
+ * @brief Dependncias de arquitetura: tipos, sees crticas e troca de contexto.
+ *
+ * PIC32 (MIPS M4K) por padro; CRONOS_HOST compila o kernel como um processo Linux (x86-64 ou AArch64).
+ */
+
+#ifndef __PORT__
+#define __PORT__
+
+#ifdef CRONOS_HOST
+// -----------------------------------
+// Linux (x86-64 / AArch64), make host
+// -----------------------------------
+#include <stdint.h>
+#define byte_t unsigned char
+#define word_t uintptr_t
+
+/**
+ * Interrupes virtuais: o tick (SIGALRM) que chega dentro de uma seo crtica
+ * fica pendente e  entregue por enable().
+ */
+extern volatile int _port_irq_off;
+extern volatile int _port_irq_pending;
+void port_irq_replay(void);
+void port_irq_enable(void);
+
+#define port_irq_save()          ({ word_t _s = !_port_irq_off; _port_irq_off = 1; asm volatile("" ::: "memory"); _s; })
+#define port_irq_on()            do { asm volatile("" ::: "memory"); _port_irq_off = 0; if(_port_irq_pending) port_irq_replay(); } while(0)
+#define PORT_IRQ_WAS_ON(S)       (S)
+
+#define __interrupt
+#define DECLARE_INTERRUPT(N,F)
+
+/**
+ * Troca de contexto: salva os registradores preservados no stack corrente,
+ * guarda o stack-pointer em *save e continua no stack sp.
+ */
+void port_switch(volatile word_t *save, word_t sp);
+#define SWITCH_CONTEXT(SAVE,SP)  do { port_switch(&(SAVE), (SP)); enable(); } while(0)
+
+#if defined(__x86_64__)
+#define GET_SP(X)                asm volatile("mov %%rsp, %0" : "=r"(X))
+#define STACK_FRAME              56                // rbx, rbp, r12-r15, retorno
+#elif defined(__aarch64__)
+#define GET_SP(X)                asm volatile("mov %0, sp" : "=r"(X))
+#define STACK_FRAME              160               // x19-x30, d8-d15
+#else
+#error "CRONOS_HOST: arquitetura no suportada (x86-64 ou AArch64)"
+#endif
+#define STACK_ALIGN              16
+
+/**
+ * Controle do tick no processo Linux.
+ */
+void port_tick(uint32_t n);
+void port_tick_start(uint32_t usec);
+void port_tick_stop(void);
+void port_idle(void);
+void port_wake(uint32_t counts, void (*fn)(void));
+
+/**
+ * Comparador do contador de ciclos (CRONOS_CLOCK): emulado, verificado pelo escalador,
+ * pelo sinal do tick e por port_idle().
+ */
+#define COMPARE_IRQ              0
+#define PORT_COMPARE_POLL()      port_compare_poll()
+void port_compare_poll(void);
+uint32_t port_cycle_hz(void);
+
+/**
+ * Vrios ncleos (CRONOS_CORES > 1): um thread POSIX por ncleo.
+ */
+uint16_t port_core_id(void);
+word_t port_lock(void);
+void port_unlock(void);
+void port_cores_run(uint16_t n, void (*fn)(void));
+
+#else
+// ----------------
+// PIC32 (MIPS M4K)
+// ----------------
+#define byte_t unsigned char
+#define int8_t char
+#define uint8_t char
+#define word_t unsigned int
+#define uint32_t unsigned int
+#define uint16_t unsigned short
+#define int32_t int
+#define int16_t short
+#define uint64_t unsigned long long
+
+#define port_irq_save()          ({ word_t _s; asm volatile("di %0" : "=r"(_s) :: "memory"); _s; })
+#define port_irq_on()            asm volatile("ei" ::: "memory")
+#define PORT_IRQ_WAS_ON(S)       ((S) & 1)         // Status.IE
+
+#define __interrupt __attribute__((interrupt))
+
+/**
+ * Troca de contexto (switch_threads, em port_pic32.c).
+ * Os registradores so salvos abaixo do stack-pointer corrente, guardado em SAVE.
+ */
+extern volatile word_t _new_sp;
+void switch_threads(void);
+void port_preempt(void);
+#define SWITCH_CONTEXT(SAVE,SP)  { asm("sw $sp, %0" : "=m"(SAVE)); _new_sp = (SP); switch_threads(); }
+#define GET_SP(X)                asm("sw $sp, %0" : "=m"(X))
+#define STACK_FRAME              40                // registradores salvos por switch_threads
+#define STACK_ALIGN              4
+
+/**
+ * Comparador do contador de ciclos (CRONOS_CLOCK): registrador Compare do CP0, interrupo do core timer.
+ */
+#define COMPARE_IRQ              0                 // _CORE_TIMER_VECTOR
+#define PORT_COMPARE_POLL()
+#endif
+
+word_t port_stack_init(word_t top, void (*thr)(void));
+void port_compare_set(word_t when);
+void port_compare_stop(void);
+
+/**
+ * Sees crticas.
+ * disable()/enable() incondicionais, para o kernel (kernel_call, scheduler) que sabe o estado corrente.
+ * critical_enter()/critical_exit() salvam e restauram o estado, e podem ser aninhadas ou usadas
+ * em interrupes:
+ *    critical_t cs;
+ *    critical_enter(cs);
+ *    ...
+ *    critical_exit(cs);
+ * IRQ_PROFILE_BEGIN/END so redefinidos por threads.h com CRONOS_IRQ_PROFILE.
+ */
+#define critical_t               word_t
+#define IRQ_PROFILE_BEGIN()
+#define IRQ_PROFILE_END()
+#define disable()                do { critical_t _cs = port_irq_save(); if(PORT_IRQ_WAS_ON(_cs)) IRQ_PROFILE_BEGIN(); } while(0)
+#define enable()                 do { IRQ_PROFILE_END(); port_irq_on(); } while(0)
+#define critical_enter(S)        do { (S) = port_irq_save(); if(PORT_IRQ_WAS_ON(S)) IRQ_PROFILE_BEGIN(); } while(0)
+#define critical_exit(S)         do { if(PORT_IRQ_WAS_ON(S)) enable(); } while(0)
+
+#endif
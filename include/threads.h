@@ -11,11 +11,251 @@
 #define MASK_WAIT               0b00011110
 #define MASK_TIMEOUT            0b00001100
 #define MASK_TERMINATE          0b11000000
+#define MASK_STATIC             0b0100000000000000
+#define MASK_TASK               0b1000000000000000
+
+// ----------------------
+// verificao dos stacks
+// ----------------------
+#define STACK_GUARD_OK(T)       (*(word_t *)((T)->sp0) == STACK_PATTERN)
+
+// ------------------------------
+// contabilizao de tempo de CPU
+// ------------------------------
+#define CPU_ACCOUNT(S,T)        { (S)->cycles += (T); (S)->runs++; if((T) > (S)->max) (S)->max = (T); }
+
+// ------------------
+// trace do escalador
+// ------------------
+#if (TRACE_SIZE & (TRACE_SIZE-1)) != 0
+#error "TRACE_SIZE deve ser potncia de 2"
+#endif
+
+/*
+ * Must be called with interrupts disabled (or from the tick interrupt).
+ */
+#ifdef CRONOS_TRACE
+#define TRACE(EV,TH,OBJ)        {                                                     \
+                                   trace_rec_t *_r;                                   \
+                                   _r = &trace_buffer[trace_head++ & (TRACE_SIZE-1)]; \
+                                   _r->time = CYCLE_CLOCK();                          \
+                                   _r->thread = (uint32_t)(word_t)(TH);               \
+                                   _r->object = (uint32_t)(word_t)(OBJ);              \
+                                   _r->event = (EV);                                  \
+                                }
+#else
+#define TRACE(EV,TH,OBJ)
+#endif
+
+// -----------------------------------
+// perfil das janelas sem interrupes
+// -----------------------------------
+#ifdef CRONOS_IRQ_PROFILE
+#undef IRQ_PROFILE_BEGIN
+#undef IRQ_PROFILE_END
+#define IRQ_PROFILE_BEGIN()     irq_profile_begin(__FILE__, __LINE__)
+#define IRQ_PROFILE_END()       irq_profile_end()
+#endif
 
 // ------------------------
 // informaes do escalador
 // ------------------------
-extern volatile thread_t *_threads[MAX_PRIO];
-extern uint16_t _thrd;
-extern volatile thread_t *_thrp;
+#if MAX_PRIO > 32
+#error "MAX_PRIO deve ser no mximo 32"
+#endif
+#if ((WAITQ_SIZE & (WAITQ_SIZE-1)) != 0) || (WAITQ_SIZE > 65536)
+#error "WAITQ_SIZE deve ser uma potncia de 2, at 65536"
+#endif
+#if (ISR_QUEUE_SIZE & (ISR_QUEUE_SIZE-1)) != 0
+#error "ISR_QUEUE_SIZE deve ser uma potncia de 2"
+#endif
+
+#if (CRONOS_CORES > 1) && !defined(CRONOS_HOST)
+#error "CRONOS_CORES > 1 somente no port host"
+#endif
+
+/**
+ * Contexto do kernel em cada ncleo: filas de prontos e thread corrente.
+ * Bloqueados, filas de espera, temporizadores e callbacks so comuns (ncleo 0 trata o tick,
+ * os callbacks e os eventos de interrupes).
+ */
+typedef struct {
+   volatile thread_t *threads[MAX_PRIO];           ///< Filas de prontos, uma por prioridade.
+   volatile thread_t *nice[MAX_PRIO];              ///< Primeiro thread que j cedeu a vez na rodada.
+   volatile word_t ready_map;                      ///< Filas no vazias (bit n = prioridade n).
+   volatile thread_t *thrp;                        ///< Thread corrente.
+   volatile word_t main_sp;                        ///< Stack-pointer do main() do ncleo.
+   volatile word_t old_sp;                         ///< Stack-pointer do thread que volta ao main().
+   volatile word_t run_start;                      ///< Ciclo em que o thread corrente entrou.
+   volatile thread_t *zombie;                      ///< Thread terminado, aguardando liberao.
+   volatile word_t slice;                          ///< Ticks restantes da fatia do thread corrente.
+} kcore_t;
+extern kcore_t _cores[CRONOS_CORES];
+
+#if CRONOS_CORES > 1
+#define CORE_ID()               port_core_id()
+#else
+#define CORE_ID()               0
+#endif
+#define _core                   (&_cores[CORE_ID()])
+#define _threads                (_core->threads)
+#define _nice                   (_core->nice)
+#define _ready_map              (_core->ready_map)
+#define _thrp                   (_core->thrp)
+#define _main_sp                (_core->main_sp)
+#define _old_sp                 (_core->old_sp)
+#define _run_start              (_core->run_start)
+#define _zombie                 (_core->zombie)
+#define _slice                  (_core->slice)
+
+/**
+ * Com mais de um ncleo as sees crticas tambm travam o kernel (port_lock).
+ */
+#if CRONOS_CORES > 1
+#undef disable
+#undef enable
+#undef critical_enter
+#undef critical_exit
+#define disable()               do { if(port_lock()) IRQ_PROFILE_BEGIN(); } while(0)
+#define enable()                do { IRQ_PROFILE_END(); port_unlock(); } while(0)
+#define critical_enter(S)       do { (S) = port_lock(); if(S) IRQ_PROFILE_BEGIN(); } while(0)
+#define critical_exit(S)        do { if(S) enable(); } while(0)
+#endif
+
+// ------------------------------
+// preempo pelo tick do sistema
+// ------------------------------
+#ifdef CRONOS_PREEMPT
+#if CRONOS_CORES > 1
+#error "CRONOS_PREEMPT somente com um ncleo"
+#endif
+extern const uint16_t preempt_quantum[MAX_PRIO];
+extern volatile bool_t _preempt;
+void kernel_preempt(void);
+#define PREEMPT_RELOAD(T)       (_slice = preempt_quantum[(T)->prio])
+#else
+#define PREEMPT_RELOAD(T)
+#endif
+
+extern volatile thread_t *_blocked;
+extern volatile thread_t *_waitq[WAITQ_SIZE];
+void thread_link(thread_t *th);
+void thread_unlink(thread_t *th);
+void thread_set_prio(thread_t *th, uint8_t prio);
+
+// ------------------------------------
+// classe EDF (earliest deadline first)
+// ------------------------------------
+#ifdef CRONOS_EDF
+#if EDF_PRIO >= MAX_PRIO
+#error "EDF_PRIO deve ser menor que MAX_PRIO"
+#endif
+void edf_link(kcore_t *c, thread_t *th);
+void edf_end(thread_t *th);
+#define EDF_RELEASE(T)          { if((T)->rel_deadline && !(T)->released) { (T)->deadline = ticks + (T)->rel_deadline; (T)->released = TRUE; } }
+#define EDF_END(T)              { if((T)->released && !(T)->f_semaphore && ((T)->f_waiting || (T)->f_time_pending)) edf_end(T); }
+#else
+#define EDF_RELEASE(T)
+#define EDF_END(T)
+#endif
+void callback_due(callback_t *cb);
+void callback_dispatch(void);
+uint16_t callback_count(void);
+
+// ---------------------------------
+// eventos postados por interrupes
+// ---------------------------------
+#define ISR_SIGNAL              1                 ///< thread_signal_from_isr.
+#define ISR_CALLBACK            2                 ///< callback_fire_from_isr.
+#define ISR_SCHEDULE            3                 ///< callback_schedule_from_isr.
+#define ISR_SEM_POST            4                 ///< sem_post_from_isr.
+#define ISR_EVENT_POST          5                 ///< event_post_from_isr.
+#define ISR_QUEUE_SEND          6                 ///< queue_send_from_isr.
+
+typedef struct {
+   volatile byte_t type;                           ///< Tipo do evento (0 = posio livre).
+   void *obj;                                      ///< Sinal, funo ou callback.
+   void *param;                                    ///< Parmetro do callback.
+   word_t time;                                    ///< Tempo do callback ou flags do evento.
+} isr_event_t;
+
+extern volatile word_t _isrq_head;
+extern volatile word_t _isrq_tail;
+void isr_queue_init(void);
+void isr_drain(void);
+#define ISRQ_PENDING()          (_isrq_tail != _isrq_head)
+
+#define PRIO_BIT(P)             ((word_t)1 << (P))
+#define HIGHEST_BIT(X)          (31 - __builtin_clz(X))
+/**
+ * Fila de espera de um objeto: hash multiplicativo do endereo, que espalha tanto bytes
+ * vizinhos (sinais, mutexes de um byte) quanto estruturas alinhadas.
+ */
+#define WAITQ_HASH(X)           ((((uint32_t)(word_t)(X) * 2654435761u) >> 16) & (WAITQ_SIZE-1))
+
+// ---------------------------------
+// mutexes com herana de prioridade
+// ---------------------------------
+void mutex_take(kmutex_t *m, thread_t *th);
+void mutex_inherit(kmutex_t *m, uint8_t prio);
+void mutex_release_all(thread_t *th);
+uint8_t mutex_inherited_prio(thread_t *th);
+
+// -----------------------------
+// semforos e grupos de eventos
+// -----------------------------
+bool_t sem_take(ksem_t *s);
+bool_t event_take(kevent_t *e, thread_t *th);
+
+// ------------------
+// filas de mensagens
+// ------------------
+bool_t queue_put(kqueue_t *q, void *msg);
+void queue_store(kqueue_t *q, void *msg);
+bool_t queue_get(kqueue_t *q, void **msg);
+void queue_block(kqueue_t *q, bool_t send);
+
+// -------------------
+// alocao de objetos
+// -------------------
+void pool_init(pool_t *p, void *mem, word_t block, uint16_t size);
+void *pool_alloc(pool_t *p);
+void pool_free(pool_t *p, void *blk);
+
+// ----------------------------
+// temporizadores (lista delta)
+// ----------------------------
+extern ktimer_t *_timers;
+void timer_start(ktimer_t *t, word_t time);
+void timer_stop(ktimer_t *t);
+void timer_tick(word_t n);
+word_t timer_next(void);
+ktimer_t *timer_expired(void);
+#define timer_init(T, TYPE)     { (T)->type = TYPE; (T)->active = FALSE; }
+
+// ---------------------------------------------
+// temporizadores abaixo de um tick (comparador)
+// ---------------------------------------------
+#define TIME_BEFORE(A, B)       ((word_t)((A) - (B)) > ((word_t)-1 >> 1))
+extern ktimer_t *_hrtimers;
+void timer_start_hr(ktimer_t *t, word_t cycles);
+ktimer_t *timer_hr_expired(void);
+
+// -----------------------
+// base de tempo do kernel
+// -----------------------
+extern word_t _tick_period;
+void kernel_idle(void);
+void clock_init(uint32_t pclock);
+void clock_update(void);
+uint64_t clock_tick(uint32_t t);
+void os_compare(void);
+
+// ------------
+// carga da CPU
+// ------------
+void load_init(void);
+void load_idle(void);
+void load_account(void);
+
 #endif
@@ -14,6 +14,32 @@
 #define TxON                    T2CONbits.TON
 #define TxCON                   T2CON
 #endif
+#if CRONOS_TIMER == 0
+/*
+ * Timer simulado, para testar a temporizao do kernel fora do processador.
+ */
+extern volatile word_t _sim_tmr;
+extern volatile word_t _sim_pr;
+extern volatile word_t _sim_con;
+extern volatile byte_t _sim_if, _sim_ie, _sim_is, _sim_ip, _sim_on;
+extern volatile uint32_t _sim_irqs;
+void sim_timer_run(uint32_t counts);
+void sim_timer_idle(void);
+#define IRQ                     8
+#define TMRx                    _sim_tmr
+#define PRx                     _sim_pr
+#define TxIF                    _sim_if
+#define TxIE                    _sim_ie
+#define TxIS                    _sim_is
+#define TxIP                    _sim_ip
+#define TxON                    _sim_on
+#define TxCON                   _sim_con
+#ifdef CRONOS_HOST
+#define IDLE_WAIT()             port_idle()
+#else
+#define IDLE_WAIT()             sim_timer_idle()
+#endif
+#endif
 #if CRONOS_TIMER == 4
 #define IRQ                     8
 #define TMRx                    TMR4
@@ -39,6 +65,18 @@
     TxIE = 1;                                   \
     TxON = 1;
 
+/**
+ * Maior valor do registrador de perodo (timers de 16 bits).
+ */
+#define TIMER_MAX               0xffff
+
+/**
+ * Espera pela prxima interrupo com o processador em modo de baixo consumo.
+ */
+#ifndef IDLE_WAIT
+#define IDLE_WAIT()             _asm("wait")
+#endif
+
 /**
  * Limpa a interrupo do timer.
  */
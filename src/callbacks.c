@@ -0,0 +1,436 @@
+/**
+ * @file callbacks.c
+ * @brief Callback timers.
+ *
+ * @author Bruno Basseto (bruno@wise-ware.org)
+ * @version 0
+ */
+
+/********************************************************************************
+ ********************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 1995-2014 Bruno Basseto.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************
+ ********************************************************************************/
+
+#include <stddef.h>
+#include "chronos.h"
+#include "config.h"
+#include "threads.h"
+
+/**
+ * Callbacks ready for execution, in the order they became due.
+ * Pending callbacks are kept in the kernel timer list, ordered by deadline.
+ */
+volatile callback_t *_callbacks;
+
+/**
+ * CPU time used by all callbacks.
+ */
+cpu_stats_t callback_cpu;
+
+/**
+ * Puts a callback into the ready queue.
+ * Must be called with interrupts disabled.
+ * @param cb Callback whose time has come.
+ */
+void
+callback_due
+   (callback_t *cb)
+{
+   list_add(&_callbacks, cb);
+   cb->queued = TRUE;
+}
+
+/**
+ * Setup a callback control block.
+ */
+static void
+callback_setup
+   (callback_t *cb,
+   void *fn,
+   void *par)
+{
+   cb->function = fn;
+   cb->param = par;
+   cb->queued = FALSE;
+   cb->running = FALSE;
+   timer_init(&cb->timer, TIMER_CALLBACK);
+}
+
+/**
+ * Clears the CPU statistics of a new callback control block.
+ */
+static void
+callback_stats_init
+   (callback_t *cb)
+{
+   cb->cpu.cycles = 0;
+   cb->cpu.runs = 0;
+   cb->cpu.max = 0;
+}
+
+/**
+ * Creates a callback, not scheduled yet.
+ * The handle remains valid until callback_delete().
+ * @param fn Callback function pointer.
+ * @param par Parameter to the callback.
+ * @return Callback handle, NULL if there is no memory.
+ */
+callback_t*
+callback_create
+   (void *fn,
+   void *par)
+{
+   critical_t cs;
+   callback_t *cb;
+
+   if(fn == NULL) return NULL;
+
+   critical_enter(cs);
+   cb = pool_alloc(&callback_pool);
+   critical_exit(cs);
+   if(cb == NULL) return NULL;
+
+   callback_setup(cb, fn, par);
+   callback_stats_init(cb);
+   cb->is_static = FALSE;
+   cb->autofree = FALSE;
+   return cb;
+}
+
+/**
+ * Puts a callback in the timer list or in the ready queue.
+ * Must be called with interrupts disabled.
+ */
+static void
+callback_start
+   (callback_t *cb,
+   word_t time)
+{
+   TRACE(TRACE_CB_FIRE, _thrp, cb->function);
+   if(cb->queued) {
+      list_remove(&_callbacks, cb);
+      cb->queued = FALSE;
+   }
+   timer_start(&cb->timer, time);
+   if(time == 0) callback_due(cb);
+}
+
+/**
+ * Schedules a callback, or changes the time of a pending one.
+ * @param cb Callback handle.
+ * @param time Time before call (0 = next scheduler pass).
+ */
+void
+callback_schedule
+   (callback_t *cb,
+   word_t time)
+{
+   critical_t cs;
+
+   critical_enter(cs);
+   callback_start(cb, time);
+   critical_exit(cs);
+}
+
+/**
+ * Cancels a callback, pending or ready. The handle remains valid.
+ * @param cb Callback handle.
+ */
+void
+callback_stop
+   (callback_t *cb)
+{
+   critical_t cs;
+
+   critical_enter(cs);
+   timer_stop(&cb->timer);
+   if(cb->queued) {
+      list_remove(&_callbacks, cb);
+      cb->queued = FALSE;
+   }
+   critical_exit(cs);
+}
+
+/**
+ * Cancels a callback and releases its handle.
+ * A callback deleting its own handle is released by callback_dispatch, after the call.
+ * @param cb Callback handle (callback_create).
+ */
+void
+callback_delete
+   (callback_t *cb)
+{
+   critical_t cs;
+
+   callback_stop(cb);
+   if(cb->is_static) return;
+   critical_enter(cs);
+   if(cb->running) cb->autofree = TRUE;
+   else pool_free(&callback_pool, cb);
+   critical_exit(cs);
+}
+
+/**
+ * Runs the callbacks that are due, in a single pass.
+ * Callbacks becoming due during the pass are left for the next one.
+ * Must be called with interrupts disabled, returns with interrupts disabled.
+ */
+void
+callback_dispatch
+   (void)
+{
+   callback_t *cb;
+   void (*c)(void *);
+   void *par;
+   uint16_t n;
+#ifdef CRONOS_ACCOUNTING
+   word_t t;
+#endif
+
+   n = list_length(_callbacks);
+   while(n--) {
+      cb = list_pop(&_callbacks);
+      if(cb == NULL) break;
+      cb->queued = FALSE;
+      c = cb->function;
+      par = cb->param;
+      if(cb->autofree) {
+         pool_free(&callback_pool, cb);
+         cb = NULL;
+      }
+      else cb->running = TRUE;                     // callback_delete waits for the end of the call.
+      TRACE(TRACE_CB_RUN, NULL, c);
+      enable();
+#ifdef CRONOS_ACCOUNTING
+      t = CYCLE_CLOCK();
+      c(par);
+      t = CYCLE_CLOCK() - t;
+      disable();
+      CPU_ACCOUNT(&callback_cpu, t);
+      if(cb != NULL) CPU_ACCOUNT(&cb->cpu, t);
+#else
+      c(par);
+      disable();
+#endif
+      if(cb != NULL) {
+         cb->running = FALSE;
+         if(cb->autofree) pool_free(&callback_pool, cb);
+      }
+      TRACE(TRACE_CB_END, NULL, c);
+   }
+}
+
+/**
+ * Looks for a callback by its function, ready or pending.
+ * Must be called with interrupts disabled.
+ * @param fn Callback function pointer.
+ * @return First callback found, NULL if none.
+ */
+static callback_t*
+callback_find
+   (void *fn)
+{
+   callback_t *cb;
+   ktimer_t *t;
+
+   list_for_each(_callbacks, cb) {
+      if(cb->function == fn) return cb;
+   }
+   for(t = _timers; t != NULL; t = t->next) {
+      if(t->type != TIMER_CALLBACK) continue;
+      cb = (callback_t *)((byte_t *)t - offsetof(callback_t, timer));
+      if(cb->function == fn) return cb;
+   }
+   return NULL;
+}
+
+/**
+ * Number of callbacks ready or pending.
+ * Must be called with interrupts disabled.
+ */
+uint16_t
+callback_count
+   (void)
+{
+   ktimer_t *t;
+   uint16_t n;
+
+   n = list_length(_callbacks);
+   for(t = _timers; t != NULL; t = t->next) {
+      if(t->type == TIMER_CALLBACK) n++;
+   }
+   return n;
+}
+
+// ---------------------------------------------
+// Function-based API (callback_fire and others)
+// ---------------------------------------------
+
+/**
+ * Add a callback function for execution.
+ * The control block is released after the call.
+ * @param fn Callback function pointer.
+ * @param par Parameter to the callback.
+ * @param time Time before call (0 = immediate).
+ */
+void 
+callback_fire
+   (void *fn, 
+   void *par, 
+   word_t time)
+{
+   critical_t cs;
+   callback_t *cb;
+
+   if(fn == NULL) return;
+
+   critical_enter(cs);
+   cb = pool_alloc(&callback_pool);
+   if(cb != NULL) {
+      callback_setup(cb, fn, par);
+      callback_stats_init(cb);
+      cb->is_static = FALSE;
+      cb->autofree = TRUE;
+      callback_start(cb, time);
+   }
+   critical_exit(cs);
+}
+
+/**
+ * Add a callback function for execution or change an existing callback parameters.
+ * @param fn Callback function pointer.
+ * @param par Parameter to the callback.
+ * @param time Time before call (0 = immediate).
+ */
+void 
+callback_refire
+   (void *fn, 
+   void *par, 
+   word_t time)
+{
+   critical_t cs;
+   callback_t *cb;
+
+   if(fn == NULL) return;
+
+   critical_enter(cs);
+   cb = callback_find(fn);
+   if(cb != NULL) {
+      /*
+       * Found, change it.
+       */
+      cb->param = par;
+      callback_start(cb, time);
+      critical_exit(cs);
+      return;
+   }
+   critical_exit(cs);
+
+   /*
+    * Not found.
+    * Create a new one.
+    */
+   callback_fire(fn, par, time);
+}
+
+/**
+ * Cancels all callbacks of a function.
+ * @param fn Callback function pointer.
+ */
+void 
+callback_cancel
+   (void *fn)
+{
+   critical_t cs;
+   callback_t *cb, *q;
+   ktimer_t *t, *u;
+
+   if(fn == NULL) return;
+
+   critical_enter(cs);
+   for(cb = (callback_t *)_callbacks; cb != NULL; cb = q) {
+      q = cb->list.next;
+      if(cb->function != fn) continue;
+      list_remove(&_callbacks, cb);
+      cb->queued = FALSE;
+      if(cb->autofree) pool_free(&callback_pool, cb);
+   }
+   for(t = _timers; t != NULL; t = u) {
+      u = t->next;
+      if(t->type != TIMER_CALLBACK) continue;
+      cb = (callback_t *)((byte_t *)t - offsetof(callback_t, timer));
+      if(cb->function != fn) continue;
+      timer_stop(t);
+      if(cb->autofree) pool_free(&callback_pool, cb);
+   }
+   critical_exit(cs);
+}
+
+/**
+ * Add a callback function for execution using a control block provided by the caller.
+ * If the block is already pending, its parameters and time are changed.
+ * The block must be zero-initialized before its first use (static storage).
+ * @param cb Callback control block.
+ * @param fn Callback function pointer.
+ * @param par Parameter to the callback.
+ * @param time Time before call (0 = immediate).
+ */
+void 
+callback_fire_static
+   (callback_t *cb,
+   void *fn, 
+   void *par, 
+   word_t time)
+{
+   critical_t cs;
+
+   if((cb == NULL) || (fn == NULL)) return;
+
+   critical_enter(cs);
+   if(!cb->queued && !cb->timer.active) {
+      /*
+       * Idle block: the statistics are only cleared on its first use.
+       */
+      callback_setup(cb, fn, par);
+      if(!cb->is_static) callback_stats_init(cb);
+      cb->is_static = TRUE;
+      cb->autofree = FALSE;
+   }
+   cb->function = fn;
+   cb->param = par;
+   callback_start(cb, time);
+   critical_exit(cs);
+}
+
+/**
+ * Cancels a callback started with callback_fire_static.
+ * @param cb Callback control block.
+ */
+void 
+callback_cancel_static
+   (callback_t *cb)
+{
+   if(cb == NULL) return;
+   callback_stop(cb);
+}
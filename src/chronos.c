@@ -33,19 +33,35 @@
  ********************************************************************************/
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <limits.h>
 #include "chronos.h"
 #include "config.h"
+#ifndef CRONOS_HOST
 #include <mx7/interrupt.h>
+#endif
 #include "threads.h"
+#ifndef CRONOS_HOST
 #include <mx7/sfr.h>
+#endif
 #include "timer.h"
 
 /**
- * List of pending callback functions.
+ * Pools for thread and callback control blocks.
  */
-volatile callback_t *_callbacks;
+pool_t thread_pool;
+pool_t callback_pool;
+#if POOL_THREADS > 0
+static thread_t _thread_blocks[POOL_THREADS];
+#else
+#define _thread_blocks        NULL
+#endif
+#if POOL_CALLBACKS > 0
+static callback_t _callback_blocks[POOL_CALLBACKS];
+#else
+#define _callback_blocks      NULL
+#endif
 
 /**
  * System tick counter.
@@ -53,19 +69,30 @@ volatile callback_t *_callbacks;
 volatile uint32_t ticks;
 
 /**
- * Wait a number of processor cycles.
- * @param cycles Number of clock cycles to wait.
+ * Timer period for one system tick.
  */
-void delay(uint32_t cycles)
+word_t _tick_period;
+
+/**
+ * Number of ticks programmed for the current timer period (tickless mode).
+ */
+static word_t _tick_span;
+
+/**
+ * Clears CPU accounting statistics.
+ * @param s Statistics block (thread_cpu, callback_cpu_stats or &callback_cpu).
+ */
+void
+cpu_stats_reset
+   (cpu_stats_t *s)
 {
-   _asm("lw $k1, %0" :: "m"(cycles));
-   _asm("mfc0 $k0, $9, 0");                     // load COUNT register.
-   _asm("addu $k1, $k0, $k1");                  // calculate final COUNT register value into $k1 = COUNT + cycles.
-   _asm("_wait_here:");
-   _asm("mfc0 $k0, $9, 0");                     // load COUNT register into $k0.
-   _asm("sub $v0, $k1, $k0");
-   _asm("bgtz $v0, _wait_here");                // wait while $k1 - COUNT >= 0
-   _asm("nop");
+   critical_t cs;
+
+   critical_enter(cs);
+   s->cycles = 0;
+   s->runs = 0;
+   s->max = 0;
+   critical_exit(cs);
 }
 
 /**
@@ -80,16 +107,132 @@ kernel_init
    /*
     * Clean all data structures.
     */
-   memset(_threads, 0, sizeof(_threads));
+   memset(_cores, 0, sizeof(_cores));
+   memset(_waitq, 0, sizeof(_waitq));
+   memset(&callback_cpu, 0, sizeof(callback_cpu));
+   _blocked = NULL;
    _callbacks = NULL;
-   _thrp = NULL;
+   _timers = NULL;
+#ifdef CRONOS_CLOCK
+   _hrtimers = NULL;
+#endif
+   isr_queue_init();
+   pool_init(&thread_pool, _thread_blocks, sizeof(thread_t), POOL_THREADS);
+   pool_init(&callback_pool, _callback_blocks, sizeof(callback_t), POOL_CALLBACKS);
    ticks = 0;
+#ifdef CRONOS_LOAD
+   load_init();
+#endif
 
    /*
     * Configure CPU timer.
     */
-   pclock /= 25600;
-   INIT_TIMER(pclock);
+   _tick_period = pclock / 25600;
+   _tick_span = 1;
+   INIT_TIMER(_tick_period);
+#ifdef CRONOS_CLOCK
+   clock_init(pclock);
+#endif
+}
+
+/**
+ * Release an expired timer: a callback becomes due, a thread wakes up (timeout or end of sleep).
+ * Must be called with interrupts disabled.
+ * @param t Timer just removed from its list.
+ */
+static void
+os_expire
+   (ktimer_t *t)
+{
+   thread_t *p, *owner;
+
+   if(t->type != TIMER_THREAD) {
+      callback_due((callback_t *)((byte_t *)t - offsetof(callback_t, timer)));
+      return;
+   }
+
+   /*
+    * Thread timming.
+    */
+   p = (thread_t *)((byte_t *)t - offsetof(thread_t, timer));
+   owner = NULL;
+   thread_unlink(p);
+   if(p->flags & MASK_TIMEOUT) {
+      if(p->f_semaphore && p->f_pi) owner = ((kmutex_t *)p->data)->owner;
+      p->flags &= (~MASK_WAIT);
+      p->f_timeout = TRUE;
+   }
+   p->f_time_pending = FALSE;
+   thread_link(p);
+
+   /*
+    * A mutex waiter gave up: the owner no longer runs with its priority.
+    */
+   if(owner != NULL) thread_set_prio(owner, mutex_inherited_prio(owner));
+}
+
+/**
+ * Account elapsed ticks and release the expired timers.
+ * Must be called with interrupts disabled.
+ * @param elapsed Number of ticks elapsed.
+ */
+static void
+os_timers
+   (word_t elapsed)
+{
+   ktimer_t *t;
+
+   ticks += elapsed;
+#ifdef CRONOS_CLOCK
+   clock_update();
+#endif
+
+   /*
+    * Only the timers expiring now are touched.
+    * Callbacks become ready just by leaving the timer list.
+    */
+   timer_tick(elapsed);
+   while((t = timer_expired()) != NULL) os_expire(t);
+}
+
+/**
+ * Idle the processor until the next interrupt.
+ * Called by the scheduler, with interrupts disabled, when there is nothing to execute.
+ * In tickless mode the timer is programmed to the next pending deadline,
+ * and the system tick counter catches up on wakeup.
+ */
+void
+kernel_idle
+   (void)
+{
+   word_t n;
+
+   /*
+    * Stretch the timer period up to the next deadline.
+    */
+   n = timer_next();
+   if(n == 0) n = TIMER_MAX;
+   if(n > TIMER_MAX / (_tick_period + 1)) n = TIMER_MAX / (_tick_period + 1);
+   if(n > 1) {
+      _tick_span = n;
+      PRx = n * (_tick_period + 1) - 1;
+   }
+
+   enable();
+   IDLE_WAIT();
+   disable();
+
+   /*
+    * Woken up by another interrupt: count the ticks elapsed so far
+    * and go back to the regular period.
+    */
+   if(_tick_span > 1) {
+      n = TMRx / (_tick_period + 1);
+      TMRx -= n * (_tick_period + 1);
+      PRx = _tick_period;
+      _tick_span = 1;
+      os_timers(n);
+   }
 }
 
 /**
@@ -100,17 +243,20 @@ void
 thread_kill
    (thread_t *th)
 {
-   byte_t prio;
-   
+   critical_t cs;
+
    /*
     * Remove thread.
     */
-   disable();
-   free((void *)(th->sp0));
-   prio = th->prio;
-   free(th);
-   list_remove(&_threads[prio], th);
-   enable();
+   critical_enter(cs);
+   timer_stop(&th->timer);
+   thread_unlink(th);
+   mutex_release_all(th);
+   if(!th->f_static) {
+      if(!th->f_task) free((void *)(th->sp0));
+      pool_free(&thread_pool, th);
+   }
+   critical_exit(cs);
 }
 
 /**
@@ -121,12 +267,16 @@ void
 thread_terminate
    (thread_t *th)
 {
+   critical_t cs;
+
    /*
     * Put thread into execution with f_terminate on.
     */
-   disable();
+   critical_enter(cs);
+   thread_unlink(th);
    th->flags = (th->flags & (~MASK_WAIT)) | MASK_TERMINATE;
-   enable();
+   thread_link(th);
+   critical_exit(cs);
 }
 
 /**
@@ -137,9 +287,13 @@ void
 thread_suspend
    (thread_t *th)
 {
-   disable();
+   critical_t cs;
+
+   critical_enter(cs);
+   thread_unlink(th);
    th->f_suspend = TRUE;
-   enable();
+   thread_link(th);
+   critical_exit(cs);
 }
 
 /**
@@ -150,9 +304,13 @@ void
 thread_release
    (thread_t *th)
 {
-   disable();
+   critical_t cs;
+
+   critical_enter(cs);
+   thread_unlink(th);
    th->f_suspend = FALSE;
-   enable();
+   thread_link(th);
+   critical_exit(cs);
 }
 
 /**
@@ -163,27 +321,29 @@ void
 thread_signal
    (void *ptr)
 {
-   int prio;
-   thread_t *p;
+   critical_t cs;
+   thread_t *p, *q;
    
    /*
-    * Search for waiting threads.
+    * Search for waiting threads in the object queue.
     */
-   disable();
-   for(prio = MAX_PRIO-1; prio >= 0; prio--) { 
-      list_for_each(_threads[prio], p) {
-         if(p->f_waiting) {
-            if(p->data == (word_t)ptr) {
-               /*
-                * Thread signaled: release it to execution.
-                */
-               p->f_waiting = FALSE;
-               if(!p->f_time_pending) p->timer = 0;
-            }
+   critical_enter(cs);
+   TRACE(TRACE_SIGNAL, _thrp, ptr);
+   for(p = (thread_t *)_waitq[WAITQ_HASH(ptr)]; p != NULL; p = q) {
+      q = p->list.next;
+      if(p->f_waiting) {
+         if(p->data == (word_t)ptr) {
+            /*
+             * Thread signaled: release it to execution.
+             */
+            thread_unlink(p);
+            p->f_waiting = FALSE;
+            if(!p->f_time_pending) timer_stop(&p->timer);
+            thread_link(p);
          }
       }
    }
-   enable();
+   critical_exit(cs);
 }
 
 /**
@@ -195,16 +355,20 @@ void
 thread_force
    (thread_t *th)
 {
-   disable();
+   critical_t cs;
+
+   critical_enter(cs);
    if(th->f_waiting) {
       /*
        * Release thread with error flag set.
        */
+      thread_unlink(th);
       th->f_waiting = FALSE;
       th->f_timeout = TRUE;
-      if(!th->f_time_pending) th->timer = 0;
+      if(!th->f_time_pending) timer_stop(&th->timer);
+      thread_link(th);
    }
-   enable();
+   critical_exit(cs);
 }
 
 /**
@@ -215,163 +379,87 @@ void
 thread_unlock
    (void *ptr)
 {
-   int prio;
-   thread_t *p;
+   critical_t cs;
+   thread_t *p, *q;
 
-   disable();
+   critical_enter(cs);
+   TRACE(TRACE_UNLOCK, _thrp, ptr);
    if(*(byte_t *)ptr == 0) {
       /*
        * Mutex already free.
        */
-      enable();
+      critical_exit(cs);
       return;
    }
 
    /*
-    * Look for other threads waiting for the mutex.
+    * Look for other threads waiting for the mutex,
+    * the first one with the highest priority gets it.
     */
-   for(prio = MAX_PRIO-1; prio >= 0; prio--) { 
-      list_for_each(_threads[prio], p) {
-         if(p->f_semaphore) {
-            if(p->data == (word_t)ptr) {
-               /*
-                * Release thread for execution, keeping mutex locked.
-                */
-               p->f_semaphore = FALSE;
-               if(!p->f_time_pending) p->timer = 0;
-               enable();
-               return;
-            }
+   q = NULL;
+   list_for_each(_waitq[WAITQ_HASH(ptr)], p) {
+      if(p->f_semaphore) {
+         if(p->data == (word_t)ptr) {
+            if((q == NULL) || (p->prio > q->prio)) q = p;
          }
       }
    }
+   if(q != NULL) {
+      /*
+       * Release thread for execution, keeping mutex locked.
+       */
+      thread_unlink(q);
+      q->f_semaphore = FALSE;
+      if(!q->f_time_pending) timer_stop(&q->timer);
+      thread_link(q);
+      critical_exit(cs);
+      return;
+   }
    
    /*
     * No more pending threads, unlock mutex.
     */
    *(byte_t *)ptr = 0;
-   enable();
+   critical_exit(cs);
 }
 
 /**
- * Add a callback function for execution.
- * @param fn Callback function pointer.
- * @param par Parameter to the callback.
- * @param time Time before call (0 = immediate).
+ * Sets current thread prioriry.
+ * @param prio Priority value: 0 = lowest, up to MAX_PRIO-1
  */
 void 
-callback_fire
-   (void *fn, 
-   void *par, 
-   word_t time)
+thread_priority
+   (uint8_t prio)
 {
-   callback_t *novo;
-   
-   if(fn == NULL) return;
- 
-   novo = malloc(sizeof(callback_t));
-   if(novo == NULL) return;
-   
-   novo->function = fn;
-   novo->param = par;
-   novo->timer = time; 
+   critical_t cs;
 
-   disable();
-   list_add(&_callbacks, novo);
-   enable();
-}
+   if(_thrp == NULL) return;
+   if(prio > MAX_PRIO-1) prio = MAX_PRIO-1;
 
-/**
- * Add a callback function for execution or change an existing callback parameters.
- * @param fn Callback function pointer.
- * @param par Parameter to the callback.
- * @param time Time before call (0 = immediate).
- */
-void 
-callback_refire
-   (void *fn, 
-   void *par, 
-   word_t time)
-{
-   callback_t *p;
-   
-   if(fn == NULL) return;
-   
-   disable();
-   
    /*
-    * Search for the callback.
+    * Keeps any priority inherited from threads waiting for our mutexes.
     */
-   list_for_each(_callbacks, p) {
-      if(p->function == fn) {
-         /*
-          * Found, change it.
-          */
-         p->timer = time;
-         p->param = par;
-         enable();
-         return;
-      }
-   }
-
-   /*
-    * Not found.
-    * Create a new one.
-    */   
-   p = malloc(sizeof(callback_t));
-   if(p == NULL) return;
-   
-   p->function = fn;
-   p->param = par;
-   p->timer = time; 
-
-   list_add(&_callbacks, p);
-   enable();
+   critical_enter(cs);
+   _thrp->base_prio = prio;
+   thread_set_prio((thread_t *)_thrp, mutex_inherited_prio((thread_t *)_thrp));
+   critical_exit(cs);
 }
 
 /**
- * Cancels a callback execution.
- * @param fn Callback function pointer.
- */
-void 
-callback_cancel
-   (void *fn)
-{
-   callback_t *p;
-   
-   if(fn == NULL) return;
-
-   disable();
-tenta:
-   list_for_each(_callbacks, p) {
-      if(p->function == fn) {
-         free(p);
-         list_remove(_callbacks, p);
-         goto tenta;
-      }
-   }
-   enable();
-}
-
-/**
- * Sets current thread prioriry.
+ * Change the priority of any thread, moving it to the corresponding queue.
+ * Must be called with interrupts disabled.
+ * @param th Thread identifier.
  * @param prio Priority value: 0 = lowest, up to MAX_PRIO-1
  */
-void 
-thread_priority
-   (uint8_t prio)
+void
+thread_set_prio
+   (thread_t *th,
+   uint8_t prio)
 {
-   int old;
-   if(_thrp == NULL) return;
-   if(prio > MAX_PRIO-1) prio = MAX_PRIO-1;
-   if(_thrp->prio == prio) return;
-
-   disable();
-   old = _thrp->prio;
-   _thrp->prio = prio;
-   list_remove(&_threads[old], _thrp);
-   list_add(&_threads[prio], _thrp);
-   enable();
+   if(th->prio == prio) return;
+   thread_unlink(th);
+   th->prio = prio;
+   thread_link(th);
 }
 
 /**
@@ -405,25 +493,85 @@ bool_t
 thread_is_running
    (thread_t *th)
 {
-   thread_t *p;
-   int i;
+   int i, k;
    
    /*
     * Search the thread ID.
     */
-   for(i=0; i<MAX_PRIO; i++) {
-      if(list_contains(_threads[i], th)) return TRUE;
+   if(list_contains(_blocked, th)) return TRUE;
+   for(k=0; k<CRONOS_CORES; k++) {
+      if(th == _cores[k].thrp) return TRUE;
+      for(i=0; i<MAX_PRIO; i++) {
+         if(list_contains(_cores[k].threads[i], th)) return TRUE;
+      }
+   }
+   for(i=0; i<WAITQ_SIZE; i++) {
+      if(list_contains(_waitq[i], th)) return TRUE;
    }
    return FALSE;
 }
 
+/**
+ * Returns the peak stack usage of a thread, measured over the painted stack.
+ * @param th Thread identifier.
+ * @return Number of bytes used (the whole stack if the guard word was overwritten, 0 for tasks).
+ */
+uint16_t
+thread_stack_usage
+   (thread_t *th)
+{
+   word_t *w, *top;
+
+   if(th->f_task) return 0;
+   w = (word_t *)th->sp0;
+   top = (word_t *)(th->sp0 + th->stack_size);
+   if(*w != STACK_PATTERN) return th->stack_size;
+   for(w++; w < top; w++) {
+      if(*w != STACK_PATTERN) break;
+   }
+   return (uint16_t)((word_t)top - (word_t)w);
+}
+
+/**
+ * Called by the scheduler of core 0 when there is nothing to run, with interrupts enabled
+ * (not in tickless mode, where kernel_idle waits for the next deadline).
+ * May be redefined by the application, for instance to enter a low-power mode;
+ * the default waits for the next interrupt with CRONOS_IDLE_WAIT.
+ */
+void __attribute__((weak))
+idle_hook
+   (void)
+{
+#ifdef CRONOS_IDLE_WAIT
+   IDLE_WAIT();
+#endif
+}
+
+/**
+ * Called when a thread has overflown its stack (CRONOS_STACK_CHECK).
+ * May be redefined by the application; the default stops the system.
+ * @param th Thread identifier.
+ */
+void __attribute__((weak))
+stack_overflow
+   (thread_t *th)
+{
+   disable();
+   unreachable();
+}
+
 /**
  * Returns the current number of threads.
  */
 uint16_t os_count_threads(void)
 {
-   register int i, n;
-   for(i=0, n=0; i<MAX_PRIO; i++) n += list_length(_threads[i]);
+   register int i, k, n;
+   n = list_length(_blocked);
+   for(k=0; k<CRONOS_CORES; k++) {
+      if(_cores[k].thrp != NULL) n++;
+      for(i=0; i<MAX_PRIO; i++) n += list_length(_cores[k].threads[i]);
+   }
+   for(i=0; i<WAITQ_SIZE; i++) n += list_length(_waitq[i]);
    return n;
 }
 
@@ -432,7 +580,12 @@ uint16_t os_count_threads(void)
  */
 uint16_t os_count_callbacks(void)
 {
-   return list_length(_callbacks);
+   critical_t cs;
+   uint16_t n;
+   critical_enter(cs);
+   n = callback_count();
+   critical_exit(cs);
+   return n;
 }
 
 /**
@@ -440,12 +593,11 @@ uint16_t os_count_callbacks(void)
  */
 uint16_t os_count_ready(void)
 {
-   register int i, n;
-   thread_t *p;
-   for(i=0, n=0; i<MAX_PRIO; i++) {
-      list_for_each(_threads, p) {
-         if((p->flags && MASK_WAIT) == 0) n++;
-      }
+   register int i, k, n;
+   n = 0;
+   for(k=0; k<CRONOS_CORES; k++) {
+      if(_cores[k].thrp != NULL) n++;
+      for(i=0; i<MAX_PRIO; i++) n += list_length(_cores[k].threads[i]);
    }
    return n;
 }
@@ -458,42 +610,67 @@ void __interrupt
 os_tick
    (void)
 {
-   word_t t;
-   int i;
-   thread_t *p;
-   callback_t *c;
-
-   ticks++;
+   word_t elapsed;
 
    /*
-    * Callback timming.
+    * A stretched period (tickless mode) counts for several ticks.
     */
-   list_for_each(_callbacks, c) {
-      if(c->timer) c->timer--;
+   elapsed = _tick_span;
+   if(elapsed > 1) {
+      PRx = _tick_period;
+      _tick_span = 1;
    }
+   os_timers(elapsed);
+   TRACE(TRACE_TICK, _thrp, elapsed);
 
+#ifdef CRONOS_PREEMPT
    /*
-    * Thread timming.
+    * Preempt the current thread when a higher priority thread or a callback is ready,
+    * or when its quantum is over and another thread of the same priority is waiting.
     */
-   for(i=0; i<MAX_PRIO; i++) {
-      list_for_each(_threads[i], p) {
-         t = p->timer;
-         if(t) {
-            t--;
-            p->timer = t;
-            if(t == 0) {
-               if(p->flags & MASK_TIMEOUT) {
-                  p->flags &= (~MASK_WAIT);
-                  p->f_timeout = TRUE;
-               }
-               p->f_time_pending = FALSE;
-            }
-         }
-      }   
+   if((_thrp != NULL) && !_thrp->f_task) {
+      _slice = (_slice > elapsed)? _slice - elapsed : 0;
+      if((_ready_map & ~((PRIO_BIT(_thrp->prio) << 1) - 1)) || (_callbacks != NULL) || ISRQ_PENDING()
+         || ((_slice == 0) && (_ready_map & PRIO_BIT(_thrp->prio))))
+         _preempt = TRUE;
    }
+#endif
 
    /*
     * Clear interrupt.
     */
    CLEAR_IRQ();
+
+#if defined(CRONOS_PREEMPT) && !defined(CRONOS_HOST)
+   if(_preempt) port_preempt();
+#endif
+}
+
+#ifdef CRONOS_CLOCK
+/**
+ * Cycle counter compare interrupt. Releases the timers shorter than one tick.
+ */
+DECLARE_INTERRUPT(COMPARE_IRQ, os_compare);
+void __interrupt
+os_compare
+   (void)
+{
+   ktimer_t *t;
+
+   port_compare_stop();
+   while((t = timer_hr_expired()) != NULL) os_expire(t);
+   if(_hrtimers != NULL) port_compare_set(_hrtimers->delta);
+
+#ifdef CRONOS_PREEMPT
+   /*
+    * A higher priority thread woke up: it runs now, not at the end of the current quantum.
+    */
+   if((_thrp != NULL) && !_thrp->f_task && (_ready_map & ~((PRIO_BIT(_thrp->prio) << 1) - 1)))
+      _preempt = TRUE;
+#endif
+
+#if defined(CRONOS_PREEMPT) && !defined(CRONOS_HOST)
+   if(_preempt) port_preempt();
+#endif
 }
+#endif
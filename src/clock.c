@@ -0,0 +1,240 @@
+/**
+ * @file clock.c
+ * @brief 64-bit monotonic clock and waits shorter than one tick, on the cycle counter compare (CRONOS_CLOCK).
+ *
+ * @author Bruno Basseto (bruno@wise-ware.org)
+ * @version 0
+ */
+
+/********************************************************************************
+ ********************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 1995-2014 Bruno Basseto.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************
+ ********************************************************************************/
+
+#include "chronos.h"
+#include "config.h"
+#include "threads.h"
+
+#ifdef CRONOS_CLOCK
+#define NS                      1000000000ull
+
+/**
+ * Frequency of cycle_count() in Hz (CYCLE_HZ, or measured by the port).
+ */
+uint32_t clock_hz;
+
+/**
+ * The cycle counter extended to 64 bits. The 32-bit COUNT register wraps in about
+ * 100 s: it is read at least once per tick (clock_update), so no wrap is ever missed.
+ */
+static uint64_t _clock;
+static word_t _clock_last;
+static uint64_t _clock_tick;                       // clock at the last tick interrupt.
+
+static uint64_t _tick_ns;                          // one system tick, in ns.
+static word_t _tick_cycles;                        // one system tick, in cycles.
+
+/**
+ * Starts the clock from 0.
+ * Called by kernel_init, after the timer setup.
+ * @param pclock Peripheral clock frequency in Hz (timer clock = pclock / 256).
+ */
+void
+clock_init
+   (uint32_t pclock)
+{
+#if CYCLE_HZ == 0
+   clock_hz = port_cycle_hz();
+#else
+   clock_hz = CYCLE_HZ;
+#endif
+   _clock = 0;
+   _clock_last = cycle_count();
+   _clock_tick = 0;
+   _tick_ns = (uint64_t)(_tick_period + 1) * 256 * NS / pclock;
+   _tick_cycles = (word_t)ns_to_cycles(_tick_ns);
+}
+
+/**
+ * Monotonic time since kernel_init.
+ * @return Number of cycle_count() cycles, 64 bits.
+ */
+uint64_t
+clock_cycles
+   (void)
+{
+   critical_t cs;
+   word_t c;
+   uint64_t r;
+
+   critical_enter(cs);
+   c = cycle_count();
+   _clock += (word_t)(c - _clock_last);
+   _clock_last = c;
+   r = _clock;
+   critical_exit(cs);
+   return r;
+}
+
+/**
+ * Records the time of the tick interrupt.
+ * Called by os_timers, with interrupts disabled.
+ */
+void
+clock_update
+   (void)
+{
+   _clock_tick = clock_cycles();
+}
+
+/**
+ * Time of a past tick, from the time of the last tick interrupt.
+ * @param t Tick number, not after ticks.
+ * @return Value of clock_cycles() at tick t.
+ */
+uint64_t
+clock_tick
+   (uint32_t t)
+{
+   critical_t cs;
+   uint64_t r;
+
+   critical_enter(cs);
+   r = _clock_tick - (uint64_t)(uint32_t)(ticks - t) * _tick_cycles;
+   critical_exit(cs);
+   return r;
+}
+
+/**
+ * Monotonic time since kernel_init.
+ * @return Nanoseconds, with the resolution of the cycle counter.
+ */
+uint64_t
+clock_ns
+   (void)
+{
+   return cycles_to_ns(clock_cycles());
+}
+
+/**
+ * Converts cycle_count() cycles to nanoseconds (rounded down).
+ */
+uint64_t
+cycles_to_ns
+   (uint64_t cycles)
+{
+   return (cycles / clock_hz) * NS + (cycles % clock_hz) * NS / clock_hz;
+}
+
+/**
+ * Converts nanoseconds to cycle_count() cycles (rounded up, waits are never shorter).
+ */
+uint64_t
+ns_to_cycles
+   (uint64_t ns)
+{
+   return (ns / NS) * clock_hz + ((ns % NS) * clock_hz + NS - 1) / NS;
+}
+
+/**
+ * Suspends the current thread until a point of clock_cycles().
+ * The whole ticks before it are slept on the system tick; the first tick comes at any point,
+ * so that sleep never goes past the end, and the rest ends on the cycle counter compare.
+ * @param end Value of clock_cycles() to wake up at.
+ * @return See thread_sleep.
+ */
+static bool_t
+clock_sleep
+   (uint64_t end)
+{
+   uint64_t now;
+
+   now = clock_cycles();
+   if((end > now) && (end - now >= _tick_cycles)) {
+      thread_sleep((word_t)((end - now) / _tick_cycles));
+      now = clock_cycles();
+   }
+   if(end <= now) return TRUE;
+   return kernel_call(SV_HRSLEEP, (word_t)(end - now));
+}
+
+/**
+ * Suspends the current thread for a number of cycles.
+ * Sleeps shorter than one tick end on the cycle counter compare; longer sleeps use
+ * the system tick for the whole ticks and the compare for the rest.
+ * @param cycles Number of cycle_count() cycles.
+ * @return See thread_sleep.
+ */
+bool_t
+thread_sleep_cycles
+   (word_t cycles)
+{
+   if(cycles >= _tick_cycles) return clock_sleep(clock_cycles() + cycles);
+   return kernel_call(SV_HRSLEEP, cycles);
+}
+
+/**
+ * Suspends the current thread for a number of nanoseconds.
+ * Same as thread_sleep_cycles.
+ * @param ns Number of nanoseconds.
+ * @return See thread_sleep.
+ */
+bool_t
+thread_sleep_ns
+   (uint64_t ns)
+{
+   if(ns >= _tick_ns) return clock_sleep(clock_cycles() + ns_to_cycles(ns));
+   return kernel_call(SV_HRSLEEP, (word_t)ns_to_cycles(ns));
+}
+
+/**
+ * Sets the timeout of the next wait of the current thread, in cycles.
+ * Timeouts shorter than one tick end on the cycle counter compare. Longer ones count
+ * system ticks, one more than needed since the first tick comes at any point: they end
+ * up to one tick late, never early.
+ * @param cycles Number of cycle_count() cycles.
+ * @return See thread_set_timeout.
+ */
+bool_t
+thread_set_timeout_cycles
+   (word_t cycles)
+{
+   if(cycles >= _tick_cycles) return thread_set_timeout((cycles + _tick_cycles - 1) / _tick_cycles + 1);
+   return kernel_call(SV_HRTIMEOUT, cycles);
+}
+
+/**
+ * Sets the timeout of the next wait of the current thread, in nanoseconds.
+ * Same as thread_set_timeout_cycles.
+ * @param ns Number of nanoseconds.
+ * @return See thread_set_timeout.
+ */
+bool_t
+thread_set_timeout_ns
+   (uint64_t ns)
+{
+   if(ns >= _tick_ns) return thread_set_timeout((word_t)((ns + _tick_ns - 1) / _tick_ns) + 1);
+   return kernel_call(SV_HRTIMEOUT, (word_t)ns_to_cycles(ns));
+}
+#endif
@@ -0,0 +1,108 @@
+/**
+ * @file edf.c
+ * @brief Earliest-deadline-first scheduling class (CRONOS_EDF).
+ *
+ * @author Bruno Basseto (bruno@wise-ware.org)
+ * @version 0
+ */
+
+/********************************************************************************
+ ********************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 1995-2014 Bruno Basseto.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************
+ ********************************************************************************/
+
+#include <stddef.h>
+#include "chronos.h"
+#include "config.h"
+#include "threads.h"
+
+#ifdef CRONOS_EDF
+/**
+ * Deadlines missed by all threads.
+ */
+uint32_t edf_misses;
+
+/**
+ * Insert a thread with deadline into the ready queue of the EDF class (priority EDF_PRIO)
+ * of a core, ordered by absolute deadline, before the threads without deadline.
+ * These keep the rounds of fixed priority (thread_link), behind the threads with deadline.
+ * Must be called with interrupts disabled, by thread_link.
+ * @param c Core.
+ * @param th Thread identifier.
+ */
+void
+edf_link
+   (kcore_t *c,
+   thread_t *th)
+{
+   thread_t *p;
+
+   list_for_each((thread_t *)c->threads[EDF_PRIO], p) {
+      if(!p->rel_deadline || ((int32_t)(th->deadline - p->deadline) < 0)) break;
+   }
+   list_insert(&c->threads[EDF_PRIO], p, th);
+   c->ready_map |= PRIO_BIT(EDF_PRIO);
+}
+
+/**
+ * End of a job: the thread is going to sleep or wait for a signal (not for a lock,
+ * a semaphore or a queue, which block inside the job). Counts a deadline miss.
+ * Must be called with interrupts disabled, by thread_link.
+ * @param th Thread identifier.
+ */
+void
+edf_end
+   (thread_t *th)
+{
+   th->released = FALSE;
+   if((int32_t)(ticks - th->deadline) > 0) {
+      th->misses++;
+      edf_misses++;
+   }
+}
+
+/**
+ * Moves the current thread to the EDF class, with a relative deadline.
+ * A job is released each time the thread becomes ready after waiting or sleeping,
+ * and must end (thread_wait or sleep again) within the deadline; the first job starts now.
+ * Among the ready threads of priority EDF_PRIO, the earliest absolute deadline runs first.
+ * @param rel Relative deadline in ticks (0 = back to fixed priority, keeping EDF_PRIO).
+ */
+void
+thread_deadline
+   (word_t rel)
+{
+   critical_t cs;
+
+   if(_thrp == NULL) return;
+
+   critical_enter(cs);
+   _thrp->rel_deadline = rel;
+   _thrp->deadline = ticks + rel;
+   _thrp->released = (rel != 0);
+   _thrp->base_prio = EDF_PRIO;
+   thread_set_prio((thread_t *)_thrp, mutex_inherited_prio((thread_t *)_thrp));
+   critical_exit(cs);
+}
+#endif
@@ -0,0 +1,153 @@
+/**
+ * @file event.c
+ * @brief Event flag groups.
+ *
+ * @author Bruno Basseto (bruno@wise-ware.org)
+ * @version 0
+ */
+
+/********************************************************************************
+ ********************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 1995-2014 Bruno Basseto.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************
+ ********************************************************************************/
+
+#include <stddef.h>
+#include "chronos.h"
+#include "config.h"
+#include "threads.h"
+
+/**
+ * Initialize an event flag group.
+ * @param e Pointer to the group.
+ * @param flags Initial flags.
+ */
+void
+event_init
+   (kevent_t *e,
+   uint32_t flags)
+{
+   e->flags = flags;
+}
+
+/**
+ * Check the condition a thread is waiting for, consuming the flags if it asked so.
+ * Must be called with interrupts disabled.
+ * @param e Pointer to the group.
+ * @param th Thread waiting (ev_mask and ev_mode set by event_wait).
+ * @return TRUE if the condition is met, the flags received are left in th->ev_mask.
+ */
+bool_t
+event_take
+   (kevent_t *e,
+   thread_t *th)
+{
+   uint32_t got;
+
+   got = e->flags & th->ev_mask;
+   if(th->ev_mode & EV_ALL) {
+      if(got != th->ev_mask) return FALSE;
+   } else {
+      if(got == 0) return FALSE;
+   }
+   if(th->ev_mode & EV_CLEAR) e->flags &= ~got;
+   th->ev_mask = got;
+   return TRUE;
+}
+
+/**
+ * Wait for flags of a group.
+ * A timeout may be set before with thread_set_timeout().
+ * @param e Pointer to the group.
+ * @param mask Flags to wait for.
+ * @param mode EV_ANY or EV_ALL, optionally with EV_CLEAR to consume the flags received.
+ * @return Flags received, 0 in case of timeout.
+ */
+uint32_t
+event_wait
+   (kevent_t *e,
+   uint32_t mask,
+   byte_t mode)
+{
+   thread_t *th;
+
+   th = (thread_t *)_thrp;
+   if((th == NULL) || (mask == 0)) return 0;
+   th->ev_mask = mask;
+   th->ev_mode = mode;
+   if(!kernel_call(SV_EVWAIT, (word_t)e)) return 0;
+   return th->ev_mask;
+}
+
+/**
+ * Set flags of a group, releasing the threads whose conditions are met.
+ * Waiting threads are checked in arrival order, each one sees the flags
+ * left by the previous ones (EV_CLEAR).
+ * @param e Pointer to the group.
+ * @param flags Flags to set.
+ */
+void
+event_post
+   (kevent_t *e,
+   uint32_t flags)
+{
+   critical_t cs;
+   thread_t *p, *q;
+
+   critical_enter(cs);
+   TRACE(TRACE_SIGNAL, _thrp, e);
+   e->flags |= flags;
+   for(p = (thread_t *)_waitq[WAITQ_HASH(e)]; p != NULL; p = q) {
+      q = p->list.next;
+      if(!p->f_semaphore || p->f_pi) continue;
+      if(p->data != (word_t)e) continue;
+      if(!event_take(e, p)) continue;
+
+      /*
+       * Condition met: release it to execution.
+       */
+      thread_unlink(p);
+      p->f_semaphore = FALSE;
+      if(!p->f_time_pending) timer_stop(&p->timer);
+      thread_link(p);
+      if(e->flags == 0) break;
+   }
+   critical_exit(cs);
+}
+
+/**
+ * Clear flags of a group.
+ * @param e Pointer to the group.
+ * @param flags Flags to clear.
+ */
+void
+event_clear
+   (kevent_t *e,
+   uint32_t flags)
+{
+   critical_t cs;
+
+   critical_enter(cs);
+   e->flags &= ~flags;
+   critical_exit(cs);
+}
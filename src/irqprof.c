@@ -0,0 +1,112 @@
+/**
+ * @file irqprof.c
+ * @brief Interrupt-disabled window profiler (CRONOS_IRQ_PROFILE).
+ *
+ * @author Bruno Basseto (bruno@wise-ware.org)
+ * @version 0
+ */
+
+/********************************************************************************
+ ********************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 1995-2014 Bruno Basseto.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************
+ ********************************************************************************/
+
+#include <string.h>
+#include "chronos.h"
+#include "config.h"
+#include "threads.h"
+
+#ifdef CRONOS_IRQ_PROFILE
+/**
+ * Longest window per code site, in CYCLE_CLOCK cycles.
+ * A site is the disable() or critical_enter() that turned interrupts off.
+ */
+irq_site_t irq_profile[IRQ_PROFILE_SITES];
+
+static const char *_file;
+static uint16_t _line;
+static word_t _start;
+static bool_t _open;
+
+/**
+ * Interrupts were just disabled.
+ * @param file Source file of the site.
+ * @param line Source line of the site.
+ */
+void
+irq_profile_begin
+   (const char *file,
+   uint16_t line)
+{
+   _file = file;
+   _line = line;
+   _open = TRUE;
+   _start = CYCLE_CLOCK();
+}
+
+/**
+ * Interrupts are going to be enabled.
+ * The site lookup is done after the measurement, so it is not counted.
+ */
+void
+irq_profile_end
+   (void)
+{
+   irq_site_t *s;
+   word_t t;
+   int i;
+
+   t = CYCLE_CLOCK() - _start;
+   if(!_open) return;
+   _open = FALSE;
+
+   for(i=0; i<IRQ_PROFILE_SITES; i++) {
+      s = &irq_profile[i];
+      if(s->file == NULL) {
+         s->file = _file;
+         s->line = _line;
+         break;
+      }
+      if((s->line == _line) && (s->file == _file)) break;
+   }
+   if(i == IRQ_PROFILE_SITES) return;              // table full.
+   s->count++;
+   if(t > s->max) s->max = t;
+}
+
+/**
+ * Clears the profile.
+ */
+void
+irq_profile_reset
+   (void)
+{
+   critical_t cs;
+
+   critical_enter(cs);
+   memset(irq_profile, 0, sizeof(irq_profile));
+   _open = FALSE;
+   critical_exit(cs);
+}
+#endif
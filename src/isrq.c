@@ -0,0 +1,257 @@
+/**
+ * @file isrq.c
+ * @brief Deferred kernel calls from interrupt handlers.
+ *
+ * @author Bruno Basseto (bruno@wise-ware.org)
+ * @version 0
+ */
+
+/********************************************************************************
+ ********************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 1995-2014 Bruno Basseto.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************
+ ********************************************************************************/
+
+#include <string.h>
+#include <stddef.h>
+#include "chronos.h"
+#include "config.h"
+#include "threads.h"
+
+/**
+ * Ring of events posted by interrupt handlers.
+ * Slots are reserved by compare-and-swap on the tail, so nested interrupts may post,
+ * and released by the scheduler, the only consumer.
+ */
+isr_event_t _isrq[ISR_QUEUE_SIZE];
+volatile word_t _isrq_head;
+volatile word_t _isrq_tail;
+
+/**
+ * Events lost because the queue was full.
+ */
+volatile word_t isr_overruns;
+
+/**
+ * Clears the queue.
+ * Called by kernel_init().
+ */
+void
+isr_queue_init
+   (void)
+{
+   memset(_isrq, 0, sizeof(_isrq));
+   _isrq_head = 0;
+   _isrq_tail = 0;
+   isr_overruns = 0;
+}
+
+/**
+ * Posts an event to the queue.
+ * @return FALSE if the queue is full.
+ */
+static bool_t
+isr_post
+   (byte_t type,
+   void *obj,
+   void *par,
+   word_t time)
+{
+   isr_event_t *e;
+   word_t t;
+
+   /*
+    * Reserve a slot.
+    */
+   do {
+      t = _isrq_tail;
+      if(t - _isrq_head >= ISR_QUEUE_SIZE) {
+         isr_overruns++;
+         return FALSE;
+      }
+   } while(!__sync_bool_compare_and_swap(&_isrq_tail, t, t + 1));
+
+   /*
+    * Fill it, the type goes last and marks it as valid.
+    */
+   e = &_isrq[t & (ISR_QUEUE_SIZE-1)];
+   e->obj = obj;
+   e->param = par;
+   e->time = time;
+   __sync_synchronize();
+   e->type = type;
+   return TRUE;
+}
+
+/**
+ * Send a signal from an interrupt handler.
+ * The waiting threads are released by the next scheduler pass.
+ * @param ptr Signal (any value).
+ * @return FALSE if the queue is full.
+ */
+bool_t
+thread_signal_from_isr
+   (void *ptr)
+{
+   return isr_post(ISR_SIGNAL, ptr, NULL, 0);
+}
+
+/**
+ * Add a callback function for execution from an interrupt handler.
+ * The control block is allocated by the next scheduler pass, as in callback_fire().
+ * @param fn Callback function pointer.
+ * @param par Parameter to the callback.
+ * @param time Time before call (0 = immediate).
+ * @return FALSE if the queue is full.
+ */
+bool_t
+callback_fire_from_isr
+   (void *fn,
+   void *par,
+   word_t time)
+{
+   if(fn == NULL) return FALSE;
+   return isr_post(ISR_CALLBACK, fn, par, time);
+}
+
+/**
+ * Schedules a callback handle from an interrupt handler (see callback_schedule).
+ * @param cb Callback handle.
+ * @param time Time before call (0 = immediate).
+ * @return FALSE if the queue is full.
+ */
+bool_t
+callback_schedule_from_isr
+   (callback_t *cb,
+   word_t time)
+{
+   if(cb == NULL) return FALSE;
+   return isr_post(ISR_SCHEDULE, cb, NULL, time);
+}
+
+/**
+ * Give a unit to a semaphore from an interrupt handler (see sem_post).
+ * @param s Pointer to the semaphore.
+ * @return FALSE if the queue is full.
+ */
+bool_t
+sem_post_from_isr
+   (ksem_t *s)
+{
+   return isr_post(ISR_SEM_POST, s, NULL, 0);
+}
+
+/**
+ * Set flags of an event group from an interrupt handler (see event_post).
+ * @param e Pointer to the group.
+ * @param flags Flags to set.
+ * @return FALSE if the queue is full.
+ */
+bool_t
+event_post_from_isr
+   (kevent_t *e,
+   uint32_t flags)
+{
+   return isr_post(ISR_EVENT_POST, e, NULL, flags);
+}
+
+/**
+ * Send a message from an interrupt handler (see queue_send).
+ * A slot is reserved now, so the message cannot be lost when the queue is drained.
+ * @param q Pointer to the queue.
+ * @param msg Message.
+ * @return FALSE if the queue or the interrupt event queue is full.
+ */
+bool_t
+queue_send_from_isr
+   (kqueue_t *q,
+   void *msg)
+{
+   word_t r;
+
+   do {
+      r = q->reserved;
+      if(q->count + r >= q->size) return FALSE;
+   } while(!__sync_bool_compare_and_swap(&q->reserved, r, r + 1));
+   if(isr_post(ISR_QUEUE_SEND, q, msg, 0)) return TRUE;
+   __sync_fetch_and_sub(&q->reserved, 1);
+   return FALSE;
+}
+
+/**
+ * Executes the events posted by interrupt handlers.
+ * Called by the scheduler, with interrupts enabled.
+ * Events posted during the drain are left for the next pass.
+ */
+void
+isr_drain
+   (void)
+{
+   critical_t cs;
+   isr_event_t *e;
+   byte_t type;
+   void *obj, *par;
+   word_t h, n, time;
+
+   n = _isrq_tail - _isrq_head;
+   while(n--) {
+      h = _isrq_head;
+      e = &_isrq[h & (ISR_QUEUE_SIZE-1)];
+      type = e->type;
+      if(type == 0) break;                        // reserved, not filled yet.
+      obj = e->obj;
+      par = e->param;
+      time = e->time;
+
+      /*
+       * Release the slot.
+       */
+      e->type = 0;
+      __sync_synchronize();
+      _isrq_head = h + 1;
+
+      switch(type) {
+         case ISR_SIGNAL:
+            thread_signal(obj);
+            break;
+         case ISR_CALLBACK:
+            callback_fire(obj, par, time);
+            break;
+         case ISR_SCHEDULE:
+            callback_schedule(obj, time);
+            break;
+         case ISR_SEM_POST:
+            sem_post(obj);
+            break;
+         case ISR_EVENT_POST:
+            event_post(obj, (uint32_t)time);
+            break;
+         case ISR_QUEUE_SEND:
+            critical_enter(cs);
+            __sync_fetch_and_sub(&((kqueue_t *)obj)->reserved, 1);
+            queue_store(obj, par);
+            critical_exit(cs);
+            break;
+      }
+   }
+}
@@ -84,27 +84,49 @@ list_push
    (void *list,
    void *item)
 {
+   list_insert(list, *(list_item_t**)list, item);
+}
+
+/**
+ * Insert an item before another element of a list.
+ * @param list Pointer to the list (= first element).
+ * @param pos Element of the list to insert before (NULL = end of the list).
+ * @param item Item to add.
+ */
+void
+list_insert
+   (void *list,
+   void *pos,
+   void *item)
+{
+   register list_item_t *q;
    register list_item_t **lst;
    
    lst = (list_item_t**)list;
    
-   if(*lst == NULL) {
+   if(pos == NULL) {
+      list_add(list, item);
+      return;
+   }
+   
+   q = LISTPTR(pos)->prev;
+   if(*lst == pos) {
       /*
-       * This is going to be the first item.
+       * Insert at the beginning.
+       * The first element prev points to the last element.
        */
+      if(q == NULL) q = pos;
+      LISTPTR(item)->prev = q;
+      LISTPTR(item)->next = pos;
+      LISTPTR(pos)->prev = item;
       *lst = item;
-      (*lst)->next = NULL;
-      (*lst)->prev = NULL;
       return;
    }
    
-   /*
-    * Insert at the beginning.
-    * list points to the first element.
-    */
-   LISTPTR(item)->prev = (*lst)->prev;
-   LISTPTR(item)->next = *lst;
-   *lst = item;
+   LISTPTR(item)->prev = q;
+   LISTPTR(item)->next = pos;
+   LISTPTR(pos)->prev = item;
+   q->next = item;
 }
 
 /**
@@ -179,7 +201,7 @@ list_pop
  */
 bool_t
 list_contains
-   (void *list,
+   (volatile void *list,
    void *item)
 {
    list_item_t *p;
@@ -196,7 +218,7 @@ list_contains
  */
 uint16_t
 list_length
-   (void *list)
+   (volatile void *list)
 {
    list_item_t *p;
    int i;
@@ -0,0 +1,162 @@
+/**
+ * @file load.c
+ * @brief CPU load monitor: idle-time accounting, sliding-window load and governor (CRONOS_LOAD).
+ *
+ * @author Bruno Basseto (bruno@wise-ware.org)
+ * @version 0
+ */
+
+/********************************************************************************
+ ********************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 1995-2014 Bruno Basseto.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************
+ ********************************************************************************/
+
+#include <string.h>
+#include "chronos.h"
+#include "config.h"
+#include "threads.h"
+
+#ifdef CRONOS_LOAD
+/**
+ * Idle periods of core 0: time from the scheduler finding nothing to run until its next pass.
+ */
+cpu_stats_t idle_cpu;
+
+/**
+ * Load of the last LOAD_WINDOW periods of LOAD_PERIOD ticks, in thousandths.
+ */
+static uint16_t _load[LOAD_WINDOW];
+static uint16_t _load_pos;
+static uint16_t _load_count;
+
+static uint32_t _period_tick;                      // ticks at the start of the current period.
+static word_t _period_start;                       // CYCLE_CLOCK at the start of the current period.
+static word_t _period_idle;                        // idle cycles in the current period.
+static word_t _idle_start;
+static bool_t _idle;
+static word_t _pass_start;                         // CYCLE_CLOCK at the start of the current pass.
+static bool_t _pass_empty;                         // no callbacks nor interrupt events in this pass.
+static void (*_governor)(uint16_t load);
+
+/**
+ * Clears the load history.
+ * Called by kernel_init.
+ */
+void
+load_init
+   (void)
+{
+   memset(&idle_cpu, 0, sizeof(idle_cpu));
+   memset(_load, 0, sizeof(_load));
+   _load_pos = 0;
+   _load_count = 0;
+   _period_tick = ticks;
+   _period_start = CYCLE_CLOCK();
+   _period_idle = 0;
+   _idle = FALSE;
+   _governor = NULL;
+}
+
+/**
+ * The scheduler found nothing to run on core 0: an idle period starts.
+ * A pass that ran no callbacks is idle from its start, so the scheduler overhead
+ * of an idle core does not count as load.
+ */
+void
+load_idle
+   (void)
+{
+   _idle_start = _pass_empty? _pass_start : CYCLE_CLOCK();
+   _idle = TRUE;
+}
+
+/**
+ * Closes the idle period and, every LOAD_PERIOD ticks, the load period.
+ * Called by the scheduler of core 0 at each pass, with interrupts enabled.
+ * The governor is called at the end of each period with the load of the whole window.
+ */
+void
+load_account
+   (void)
+{
+   word_t now, t, total;
+
+   now = CYCLE_CLOCK();
+   _pass_start = now;
+   _pass_empty = (_callbacks == NULL) && !ISRQ_PENDING();
+   if(_idle) {
+      _idle = FALSE;
+      t = now - _idle_start;
+      _period_idle += t;
+      CPU_ACCOUNT(&idle_cpu, t);
+   }
+   if(ticks - _period_tick < LOAD_PERIOD) return;
+
+   total = now - _period_start;
+   if((total == 0) || (_period_idle >= total)) _load[_load_pos] = 0;
+   else _load[_load_pos] = (uint16_t)(1000 - (uint64_t)_period_idle * 1000 / total);
+   if(++_load_pos == LOAD_WINDOW) _load_pos = 0;
+   if(_load_count < LOAD_WINDOW) _load_count++;
+   _period_tick = ticks;
+   _period_start = now;
+   _period_idle = 0;
+
+   if(_governor != NULL) {
+      _governor(cpu_load());
+      _pass_start = CYCLE_CLOCK();
+   }
+}
+
+/**
+ * CPU load of core 0 over the last LOAD_WINDOW periods of LOAD_PERIOD ticks.
+ * @return Busy time in thousandths (0 to 1000), 0 before the first period ends.
+ */
+uint16_t
+cpu_load
+   (void)
+{
+   critical_t cs;
+   uint32_t sum;
+   uint16_t i, n;
+
+   critical_enter(cs);
+   sum = 0;
+   for(i=0; i<_load_count; i++) sum += _load[i];
+   n = _load_count;
+   critical_exit(cs);
+   return (n == 0)? 0 : (uint16_t)(sum / n);
+}
+
+/**
+ * Installs the governor, called by the scheduler with the CPU load (cpu_load) at the end
+ * of each period of LOAD_PERIOD ticks, for instance to scale the CPU clock.
+ * @param fn Governor function (NULL = none).
+ */
+void
+cpu_governor
+   (void (*fn)(uint16_t load))
+{
+   _governor = fn;
+}
+#endif
@@ -0,0 +1,250 @@
+/**
+ * @file mutex.c
+ * @brief Mutexes with owner, priority inheritance and recursion.
+ *
+ * @author Bruno Basseto (bruno@wise-ware.org)
+ * @version 0
+ */
+
+/********************************************************************************
+ ********************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 1995-2014 Bruno Basseto.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************
+ ********************************************************************************/
+
+#include <stdlib.h>
+#include "chronos.h"
+#include "config.h"
+#include "threads.h"
+
+/**
+ * Initialize a mutex.
+ * @param m Pointer to the mutex.
+ * @param recursive TRUE to allow the owner to lock it again.
+ */
+void
+mutex_init
+   (kmutex_t *m,
+   bool_t recursive)
+{
+   m->owner = NULL;
+   m->count = 0;
+   m->recursive = recursive;
+}
+
+/**
+ * Give a mutex to a thread.
+ * Must be called with interrupts disabled.
+ * @param m Pointer to the mutex.
+ * @param th New owner.
+ */
+void
+mutex_take
+   (kmutex_t *m,
+   thread_t *th)
+{
+   m->owner = th;
+   m->count = 1;
+   list_add(&th->mutexes, m);
+}
+
+/**
+ * Find the next thread to get a mutex.
+ * @param m Pointer to the mutex.
+ * @return The first waiting thread with the highest priority, or NULL.
+ */
+static thread_t*
+mutex_waiter
+   (kmutex_t *m)
+{
+   thread_t *p, *q;
+
+   q = NULL;
+   list_for_each(_waitq[WAITQ_HASH(m)], p) {
+      if(p->f_semaphore && p->f_pi) {
+         if(p->data == (word_t)m) {
+            if((q == NULL) || (p->prio > q->prio)) q = p;
+         }
+      }
+   }
+   return q;
+}
+
+/**
+ * Raise the priority of a mutex owner to the priority of a waiting thread.
+ * Follows the chain of owners blocked on other mutexes.
+ * Must be called with interrupts disabled.
+ * @param m Pointer to the mutex.
+ * @param prio Priority of the waiting thread.
+ */
+void
+mutex_inherit
+   (kmutex_t *m,
+   uint8_t prio)
+{
+   thread_t *th;
+
+   th = m->owner;
+   while((th != NULL) && (th->prio < prio)) {
+      thread_set_prio(th, prio);
+      if(!(th->f_semaphore && th->f_pi)) break;
+      th = ((kmutex_t *)th->data)->owner;
+   }
+}
+
+/**
+ * Priority a thread must run with: its own priority or
+ * the highest priority of the threads waiting for its mutexes.
+ * Must be called with interrupts disabled.
+ * @param th Thread identifier.
+ * @return Effective priority.
+ */
+uint8_t
+mutex_inherited_prio
+   (thread_t *th)
+{
+   uint8_t prio;
+   kmutex_t *m;
+   thread_t *p;
+
+   prio = th->base_prio;
+   list_for_each(th->mutexes, m) {
+      p = mutex_waiter(m);
+      if((p != NULL) && (p->prio > prio)) prio = p->prio;
+   }
+   return prio;
+}
+
+/**
+ * Release a mutex, handing it to the next waiting thread.
+ * Must be called with interrupts disabled.
+ * @param m Pointer to the mutex.
+ */
+static void
+mutex_give
+   (kmutex_t *m)
+{
+   thread_t *p;
+
+   list_remove(&m->owner->mutexes, m);
+   p = mutex_waiter(m);
+   if(p == NULL) {
+      /*
+       * No more pending threads, unlock mutex.
+       */
+      m->owner = NULL;
+      m->count = 0;
+      return;
+   }
+
+   /*
+    * Release thread for execution, keeping mutex locked.
+    */
+   thread_unlink(p);
+   p->f_semaphore = FALSE;
+   if(!p->f_time_pending) timer_stop(&p->timer);
+   mutex_take(m, p);
+   thread_link(p);
+
+   /*
+    * The new owner inherits from the threads still waiting.
+    */
+   p = mutex_waiter(m);
+   if(p != NULL) mutex_inherit(m, p->prio);
+}
+
+/**
+ * Try to lock a mutex without blocking.
+ * @param m Pointer to the mutex.
+ * @return TRUE if the mutex was locked by the current thread.
+ */
+bool_t
+mutex_trylock
+   (kmutex_t *m)
+{
+   critical_t cs;
+
+   if(_thrp == NULL) return FALSE;
+
+   critical_enter(cs);
+   if(m->owner == NULL) {
+      mutex_take(m, (thread_t *)_thrp);
+      critical_exit(cs);
+      return TRUE;
+   }
+   if((m->owner == _thrp) && m->recursive) {
+      m->count++;
+      critical_exit(cs);
+      return TRUE;
+   }
+   critical_exit(cs);
+   return FALSE;
+}
+
+/**
+ * Unlock a mutex previously locked by the current thread.
+ * The mutex goes to the waiting thread with the highest priority,
+ * and the current thread returns to the priority it had before inheriting.
+ * @param m Pointer to the mutex.
+ */
+void
+mutex_unlock
+   (kmutex_t *m)
+{
+   critical_t cs;
+   thread_t *th;
+
+   critical_enter(cs);
+   th = (thread_t *)_thrp;
+   if((th == NULL) || (m->owner != th)) {
+      /*
+       * Not the owner.
+       */
+      critical_exit(cs);
+      return;
+   }
+   TRACE(TRACE_UNLOCK, th, m);
+   if(--m->count) {
+      /*
+       * Still locked (recursion).
+       */
+      critical_exit(cs);
+      return;
+   }
+
+   mutex_give(m);
+   thread_set_prio(th, mutex_inherited_prio(th));
+   critical_exit(cs);
+}
+
+/**
+ * Release all mutexes owned by a thread that is ending.
+ * Must be called with interrupts disabled.
+ * @param th Thread identifier.
+ */
+void
+mutex_release_all
+   (thread_t *th)
+{
+   while(th->mutexes != NULL) mutex_give(th->mutexes);
+}
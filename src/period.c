@@ -0,0 +1,123 @@
+/**
+ * @file period.c
+ * @brief Periodic threads released at absolute ticks, with release jitter and overrun statistics (CRONOS_CLOCK).
+ *
+ * @author Bruno Basseto (bruno@wise-ware.org)
+ * @version 0
+ */
+
+/********************************************************************************
+ ********************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 1995-2014 Bruno Basseto.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************
+ ********************************************************************************/
+
+#include <string.h>
+#include "chronos.h"
+#include "config.h"
+#include "threads.h"
+
+#ifdef CRONOS_CLOCK
+/**
+ * Starts a periodic release pattern for the current thread.
+ * The first release is one period from now; the thread then loops on period_wait:
+ *    kperiod_t p;
+ *    period_init(&p, 10);
+ *    for(;;) {
+ *       period_wait(&p);
+ *       ...
+ *    }
+ * @param p Release pattern and statistics, owned by the thread.
+ * @param period Period in ticks (not 0).
+ */
+void
+period_init
+   (kperiod_t *p,
+   word_t period)
+{
+   p->period = period;
+   p->release = ticks;
+   period_stats_reset(p);
+}
+
+/**
+ * Clears the statistics of a release pattern.
+ * @param p Release pattern.
+ */
+void
+period_stats_reset
+   (kperiod_t *p)
+{
+   p->releases = 0;
+   p->overruns = 0;
+   p->skipped = 0;
+   p->jitter_min = 0xffffffff;
+   p->jitter_max = 0;
+   memset(p->hist, 0, sizeof(p->hist));
+}
+
+/**
+ * Suspends the current thread until its next release.
+ * Releases are absolute (the last one plus the period), so neither the run time nor the
+ * scheduling delays accumulate. After an overrun (the next release is already past) the
+ * missed releases are dropped and the thread runs at once, keeping the phase; only
+ * releases reached in time go into the jitter statistics.
+ * @param p Release pattern.
+ * @return See thread_sleep.
+ */
+bool_t
+period_wait
+   (kperiod_t *p)
+{
+   uint32_t n;
+   uint64_t j;
+   uint16_t i;
+   bool_t r;
+
+   p->release += p->period;
+   n = ticks - p->release;
+   if(!(n & 0x80000000)) {
+      n /= p->period;
+      p->release += n * p->period;
+      p->skipped += n;
+      p->overruns++;
+      return thread_yield();
+   }
+
+   r = thread_sleep_until(p->release);
+   if((ticks - p->release) & 0x80000000) return r;  // forced out of the sleep.
+
+   /*
+    * Delay from the release tick to the thread running.
+    */
+   j = cycles_to_ns(clock_cycles() - clock_tick(p->release));
+   if(j > 0xffffffff) j = 0xffffffff;
+   if(j < p->jitter_min) p->jitter_min = (uint32_t)j;
+   if(j > p->jitter_max) p->jitter_max = (uint32_t)j;
+   j /= 1000;
+   for(i=0; j && (i < PERIOD_HIST - 1); i++) j >>= 1;
+   p->hist[i]++;
+   p->releases++;
+   return r;
+}
+#endif
@@ -0,0 +1,121 @@
+/**
+ * @file pool.c
+ * @brief Fixed-block pools for kernel objects.
+ *
+ * @author Bruno Basseto (bruno@wise-ware.org)
+ * @version 0
+ */
+
+/********************************************************************************
+ ********************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 1995-2014 Bruno Basseto.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************
+ ********************************************************************************/
+
+#include <stdlib.h>
+#include "chronos.h"
+#include "config.h"
+#include "threads.h"
+
+/**
+ * Setup a pool of fixed-size blocks.
+ * @param p Pool to setup.
+ * @param mem Memory for the blocks (NULL when size = 0).
+ * @param block Size of each block in bytes (at least one pointer).
+ * @param size Number of blocks (0 = allocate with malloc).
+ */
+void
+pool_init
+   (pool_t *p,
+   void *mem,
+   word_t block,
+   uint16_t size)
+{
+   uint16_t i;
+   byte_t *b;
+
+   p->free = NULL;
+   p->block = block;
+   p->size = size;
+   p->used = 0;
+   p->peak = 0;
+
+   /*
+    * Chain all blocks into the free list.
+    */
+   b = (byte_t *)mem;
+   for(i = 0; i < size; i++) {
+      *(void **)b = p->free;
+      p->free = b;
+      b += block;
+   }
+}
+
+/**
+ * Allocate a block from a pool.
+ * Must be called with interrupts disabled.
+ * Safe from interrupt context, unless the pool falls back to malloc (size = 0).
+ * @param p Pool.
+ * @return Pointer to the block, or NULL if the pool is exhausted.
+ */
+void*
+pool_alloc
+   (pool_t *p)
+{
+   void *b;
+
+   if(p->size == 0) b = malloc(p->block);
+   else {
+      b = p->free;
+      if(b != NULL) p->free = *(void **)b;
+   }
+   if(b == NULL) return NULL;
+
+   /*
+    * Usage counters.
+    */
+   p->used++;
+   if(p->used > p->peak) p->peak = p->used;
+   return b;
+}
+
+/**
+ * Return a block to its pool.
+ * Must be called with interrupts disabled.
+ * @param p Pool.
+ * @param blk Block previously allocated by pool_alloc().
+ */
+void
+pool_free
+   (pool_t *p,
+   void *blk)
+{
+   if(blk == NULL) return;
+   p->used--;
+   if(p->size == 0) {
+      free(blk);
+      return;
+   }
+   *(void **)blk = p->free;
+   p->free = blk;
+}
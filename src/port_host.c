@@ -0,0 +1,599 @@
+/**
+ * @file port_host.c
+ * @brief Linux host port (x86-64, AArch64): context switch, virtual interrupts and tick.
+ *
+ * @author Bruno Basseto (bruno@wise-ware.org)
+ * @version 0
+ */
+
+/********************************************************************************
+ ********************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 1995-2014 Bruno Basseto.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************
+ ********************************************************************************/
+
+#include <signal.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/time.h>
+#include <time.h>
+#include "chronos.h"
+#include "config.h"
+#include "threads.h"
+#include "timer.h"
+
+#ifdef CRONOS_HOST
+
+/**
+ * Virtual interrupt state.
+ * disable()/enable() only set a flag: a tick signal arriving inside a critical section
+ * is counted in _port_irq_pending and delivered by enable().
+ */
+volatile int _port_irq_off;
+volatile int _port_irq_pending;
+
+#if CRONOS_CORES > 1
+/**
+ * Kernel lock: all critical sections of all cores.
+ * Holds the number of the owner core + 1, 0 when free.
+ */
+static volatile word_t _port_lock_owner;
+#define PORT_LOCK_IRQ           ((word_t)-1)     // held by the tick signal handler.
+
+static __thread uint16_t _port_core;                     ///< Core run by this POSIX thread.
+static void (*_port_core_fn)(void);
+#endif
+
+static volatile int _port_ticking;                       ///< Tick driven by SIGALRM (port_tick_start).
+static uint32_t _port_wake;                              ///< Idle timer counts before the simulated interrupt.
+static void (*_port_wake_fn)(void);                      ///< Simulated interrupt handler (port_wake).
+#ifdef CRONOS_CLOCK
+static volatile word_t _port_compare;                    ///< Cycle counter compare (port_compare_set).
+static volatile int _port_compare_on;
+#endif
+static char _port_sigstack[65536];                       ///< Signal stack, thread stacks are kept small.
+
+void port_thread_start(void);
+void port_thread_exit(void);
+
+/**
+ * Switch stacks.
+ * Saves the callee-saved registers on the current stack, stores the stack pointer into *save,
+ * loads the new stack pointer and restores the registers saved there.
+ * void port_switch(volatile word_t *save, word_t sp);
+ */
+_asm(".text");
+_asm(".globl port_switch");
+_asm(".globl port_thread_start");
+#if defined(__x86_64__)
+_asm("port_switch:");
+_asm("pushq %rbp");
+_asm("pushq %rbx");
+_asm("pushq %r12");
+_asm("pushq %r13");
+_asm("pushq %r14");
+_asm("pushq %r15");
+_asm("movq %rsp, (%rdi)");
+_asm("movq %rsi, %rsp");
+_asm("popq %r15");
+_asm("popq %r14");
+_asm("popq %r13");
+_asm("popq %r12");
+_asm("popq %rbx");
+_asm("popq %rbp");
+_asm("ret");
+
+/*
+ * First return of a new thread: entry point in %rbx.
+ */
+_asm("port_thread_start:");
+_asm("call port_irq_enable");
+_asm("call *%rbx");
+_asm("call port_thread_exit");
+_asm("hlt");
+#elif defined(__aarch64__)
+_asm("port_switch:");
+_asm("sub sp, sp, #160");
+_asm("stp x19, x20, [sp, #0]");
+_asm("stp x21, x22, [sp, #16]");
+_asm("stp x23, x24, [sp, #32]");
+_asm("stp x25, x26, [sp, #48]");
+_asm("stp x27, x28, [sp, #64]");
+_asm("stp x29, x30, [sp, #80]");
+_asm("stp d8, d9, [sp, #96]");
+_asm("stp d10, d11, [sp, #112]");
+_asm("stp d12, d13, [sp, #128]");
+_asm("stp d14, d15, [sp, #144]");
+_asm("mov x9, sp");
+_asm("str x9, [x0]");
+_asm("mov sp, x1");
+_asm("ldp x19, x20, [sp, #0]");
+_asm("ldp x21, x22, [sp, #16]");
+_asm("ldp x23, x24, [sp, #32]");
+_asm("ldp x25, x26, [sp, #48]");
+_asm("ldp x27, x28, [sp, #64]");
+_asm("ldp x29, x30, [sp, #80]");
+_asm("ldp d8, d9, [sp, #96]");
+_asm("ldp d10, d11, [sp, #112]");
+_asm("ldp d12, d13, [sp, #128]");
+_asm("ldp d14, d15, [sp, #144]");
+_asm("add sp, sp, #160");
+_asm("ret");
+
+/*
+ * First return of a new thread: entry point in x19.
+ */
+_asm("port_thread_start:");
+_asm("bl port_irq_enable");
+_asm("blr x19");
+_asm("bl port_thread_exit");
+_asm("brk #0");
+#endif
+
+/**
+ * Setup the initial stack of a thread: port_switch will return to port_thread_start,
+ * which enables interrupts and calls the thread entry point.
+ * @param top Stack top (16-byte aligned).
+ * @param thr Thread function entry point.
+ * @return Initial stack pointer.
+ */
+word_t
+port_stack_init
+   (word_t top,
+   void (*thr)(void))
+{
+   word_t *sp;
+
+   sp = (word_t *)(top - STACK_FRAME);
+   memset(sp, 0, STACK_FRAME);
+#if defined(__x86_64__)
+   sp[4] = (word_t)thr;                                  // rbx
+   sp[6] = (word_t)port_thread_start;                    // return address
+#else
+   sp[0] = (word_t)thr;                                  // x19
+   sp[11] = (word_t)port_thread_start;                   // x30
+#endif
+   return (word_t)sp;
+}
+
+/**
+ * A thread function returned: end the thread.
+ */
+void
+port_thread_exit
+   (void)
+{
+   thread_end();
+}
+
+/**
+ * Reads the processor cycle counter (TSC on x86-64, virtual counter on AArch64).
+ * Default CPU accounting clock source (CYCLE_CLOCK).
+ */
+word_t cycle_count(void)
+{
+#if defined(__x86_64__)
+   uint32_t lo, hi;
+   _asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+   return ((word_t)hi << 32) | lo;
+#else
+   word_t c;
+   _asm volatile("mrs %0, cntvct_el0" : "=r"(c));
+   return c;
+#endif
+}
+
+/**
+ * Wait a number of processor cycles.
+ * @param cycles Number of clock cycles to wait.
+ */
+void delay(uint32_t cycles)
+{
+   word_t t;
+
+   t = cycle_count();
+   while(cycle_count() - t < cycles);
+}
+
+#ifdef CRONOS_CLOCK
+/**
+ * Measures the cycle counter frequency (CYCLE_HZ = 0), once.
+ * @return Frequency of cycle_count() in Hz.
+ */
+uint32_t
+port_cycle_hz
+   (void)
+{
+   static uint32_t hz;
+   struct timespec t0, t1;
+   uint64_t ns;
+   word_t c;
+
+   if(hz) return hz;
+   clock_gettime(CLOCK_MONOTONIC, &t0);
+   c = cycle_count();
+   do {
+      clock_gettime(CLOCK_MONOTONIC, &t1);
+      ns = (uint64_t)(t1.tv_sec - t0.tv_sec) * 1000000000ull + t1.tv_nsec - t0.tv_nsec;
+   } while(ns < 20000000ull);
+   hz = (uint32_t)((double)(cycle_count() - c) * 1e9 / ns);
+   return hz;
+}
+
+/**
+ * Program the emulated one-shot compare of the cycle counter.
+ * @param when Value of cycle_count() for the compare interrupt.
+ */
+void
+port_compare_set
+   (word_t when)
+{
+   _port_compare = when;
+   _port_compare_on = 1;
+}
+
+/**
+ * Disable the emulated compare.
+ */
+void
+port_compare_stop
+   (void)
+{
+   _port_compare_on = 0;
+}
+
+/**
+ * Run the compare interrupt if its deadline has passed.
+ * Must be called with the virtual interrupts disabled.
+ * @return Non zero if os_compare ran.
+ */
+static int
+port_compare_check
+   (void)
+{
+   if(!_port_compare_on || TIME_BEFORE(cycle_count(), _port_compare)) return 0;
+   _port_compare_on = 0;
+   os_compare();
+   return 1;
+}
+
+/**
+ * Deliver the compare interrupt if its deadline has passed (PORT_COMPARE_POLL).
+ * Called by the scheduler, outside critical sections.
+ */
+void
+port_compare_poll
+   (void)
+{
+   if(!_port_compare_on) return;
+   disable();
+   port_compare_check();
+#ifdef CRONOS_PREEMPT
+   if(_preempt) {
+      kernel_preempt();
+      return;
+   }
+#endif
+   enable();
+}
+#endif
+
+/**
+ * Deliver the ticks that arrived inside critical sections.
+ * Called by enable().
+ */
+void
+port_irq_replay
+   (void)
+{
+   int n;
+
+   while(_port_irq_pending) {
+      _port_irq_off = 1;
+      n = __atomic_exchange_n(&_port_irq_pending, 0, __ATOMIC_SEQ_CST);
+      sim_timer_run(n * (_tick_period + 1));
+#ifdef CRONOS_PREEMPT
+      if(_preempt) {
+         kernel_preempt();                         // enable() is a safe point of the thread.
+         continue;
+      }
+#endif
+      _port_irq_off = 0;
+   }
+}
+
+/**
+ * Function version of enable(), for assembly code.
+ */
+void
+port_irq_enable
+   (void)
+{
+   enable();
+}
+
+/**
+ * SIGALRM handler: one tick of the system timer.
+ * With CRONOS_PREEMPT the handler runs on the stack of the interrupted thread, where the
+ * kernel saves its whole context (signal frame), and may switch to main from there; the tick
+ * signal is not blocked inside the handler (SA_NODEFER), so it keeps coming while main runs.
+ */
+static void
+port_signal
+   (int sig)
+{
+#if CRONOS_CORES > 1
+   if(!__sync_bool_compare_and_swap(&_port_lock_owner, 0, PORT_LOCK_IRQ)) {
+      __atomic_fetch_add(&_port_irq_pending, 1, __ATOMIC_SEQ_CST);
+      return;
+   }
+   _port_irq_off = 1;
+   sim_timer_run(_tick_period + 1);
+   _port_irq_off = 0;
+   __sync_lock_release(&_port_lock_owner);
+#else
+   if(_port_irq_off) {
+      __atomic_fetch_add(&_port_irq_pending, 1, __ATOMIC_SEQ_CST);
+      return;
+   }
+   _port_irq_off = 1;
+   sim_timer_run(_tick_period + 1);
+#ifdef CRONOS_CLOCK
+   port_compare_check();
+#endif
+#ifdef CRONOS_PREEMPT
+   if(_preempt) {
+      kernel_preempt();                            // back here when the thread runs again.
+      return;
+   }
+#endif
+   _port_irq_off = 0;
+#endif
+}
+
+/**
+ * Advance the virtual time by a number of ticks, running the tick interrupt.
+ * Must not be called inside a critical section.
+ * @param n Number of ticks.
+ */
+void
+port_tick
+   (uint32_t n)
+{
+   disable();
+   sim_timer_run(n * (_tick_period + 1));
+#ifdef CRONOS_PREEMPT
+   if(_preempt) {
+      kernel_preempt();
+      return;
+   }
+#endif
+   enable();
+}
+
+/**
+ * Drive the system tick from a real-time interval timer (SIGALRM).
+ * @param usec Tick period in microseconds.
+ */
+void
+port_tick_start
+   (uint32_t usec)
+{
+   struct sigaction sa;
+   struct itimerval it;
+   stack_t ss;
+
+   ss.ss_sp = _port_sigstack;
+   ss.ss_size = sizeof(_port_sigstack);
+   ss.ss_flags = 0;
+   sigaltstack(&ss, NULL);
+
+   memset(&sa, 0, sizeof(sa));
+   sa.sa_handler = port_signal;
+#ifdef CRONOS_PREEMPT
+   sa.sa_flags = SA_NODEFER | SA_RESTART;
+#else
+   sa.sa_flags = SA_ONSTACK | SA_RESTART;
+#endif
+   sigemptyset(&sa.sa_mask);
+   sigaction(SIGALRM, &sa, NULL);
+
+   it.it_interval.tv_sec = usec / 1000000;
+   it.it_interval.tv_usec = usec % 1000000;
+   it.it_value = it.it_interval;
+   _port_ticking = 1;
+   setitimer(ITIMER_REAL, &it, NULL);
+}
+
+/**
+ * Stop the real-time tick, back to virtual time (port_tick).
+ */
+void
+port_tick_stop
+   (void)
+{
+   struct itimerval it;
+
+   memset(&it, 0, sizeof(it));
+   setitimer(ITIMER_REAL, &it, NULL);
+   _port_ticking = 0;
+}
+
+/**
+ * Idle until the next tick (IDLE_WAIT).
+ * With the real-time tick, sleeps until SIGALRM; in virtual time, jumps to the next timer interrupt,
+ * or to the interrupt of port_wake() when it comes first.
+ * With the compare programmed, spins until it expires: it is shorter than one tick.
+ */
+void
+port_idle
+   (void)
+{
+   sigset_t m, old;
+   void (*fn)(void);
+   word_t n;
+
+#ifdef CRONOS_CLOCK
+   if(_port_compare_on) {
+      while(_port_compare_on && TIME_BEFORE(cycle_count(), _port_compare));
+      port_compare_poll();
+      return;
+   }
+#endif
+   if(!_port_ticking) {
+      disable();
+      n = _sim_pr - _sim_tmr + 1;
+      if((_port_wake_fn != NULL) && (_port_wake < n)) {
+         fn = _port_wake_fn;
+         _port_wake_fn = NULL;
+         sim_timer_run(_port_wake);
+         fn();
+      } else {
+         if(_port_wake_fn != NULL) _port_wake -= n;
+         sim_timer_idle();
+      }
+      enable();
+      return;
+   }
+   sigemptyset(&m);
+   sigaddset(&m, SIGALRM);
+   sigprocmask(SIG_BLOCK, &m, &old);
+   sigdelset(&old, SIGALRM);
+   sigsuspend(&old);
+   sigprocmask(SIG_UNBLOCK, &m, NULL);
+}
+
+/**
+ * Simulate an interrupt from another source, in virtual time.
+ * The handler is called, with interrupts disabled, after the given number of timer counts
+ * spent idle; an idle wait reaching it ends there, before the next timer interrupt.
+ * @param counts Idle timer counts before the interrupt.
+ * @param fn Interrupt handler.
+ */
+void
+port_wake
+   (uint32_t counts,
+   void (*fn)(void))
+{
+   disable();
+   _port_wake = counts;
+   _port_wake_fn = fn;
+   enable();
+}
+
+#if CRONOS_CORES > 1
+/**
+ * Core run by the calling POSIX thread.
+ * Not inlined: a kernel thread may continue on another core after a context switch.
+ */
+uint16_t __attribute__((noinline))
+port_core_id
+   (void)
+{
+   return _port_core;
+}
+
+/**
+ * Take the kernel lock (disable(), critical_enter()).
+ * @return 0 if the current core already had it, 1 otherwise.
+ */
+word_t
+port_lock
+   (void)
+{
+   word_t me;
+   int n;
+
+   me = port_core_id() + 1;
+   if(_port_lock_owner == me) return 0;
+   n = 0;
+   while(!__sync_bool_compare_and_swap(&_port_lock_owner, 0, me)) {
+      if(++n == 100) {
+         sched_yield();                            // the owner may have been preempted by Linux.
+         n = 0;
+      }
+   }
+   _port_irq_off = 1;
+   return 1;
+}
+
+/**
+ * Release the kernel lock (enable()), delivering the pending ticks first.
+ */
+void
+port_unlock
+   (void)
+{
+   if(_port_lock_owner != port_core_id() + 1) return;
+   if(_port_irq_pending) port_irq_replay();
+   _port_irq_off = 0;
+   __sync_lock_release(&_port_lock_owner);
+}
+
+/**
+ * Entry of the POSIX thread of a core.
+ */
+static void*
+port_core_main
+   (void *arg)
+{
+   _port_core = (uint16_t)(word_t)arg;
+   _port_core_fn();
+   return NULL;
+}
+
+/**
+ * Run a function in n cores at the same time: core 0 is the calling thread,
+ * the others get a POSIX thread each. Returns when all have returned.
+ * @param n Number of cores (up to CRONOS_CORES).
+ * @param fn Main loop of each core (usually calls scheduler()).
+ */
+void
+port_cores_run
+   (uint16_t n,
+   void (*fn)(void))
+{
+   pthread_t th[CRONOS_CORES];
+   uint16_t k;
+
+   if(n > CRONOS_CORES) n = CRONOS_CORES;
+   _port_core_fn = fn;
+   for(k=1; k<n; k++) pthread_create(&th[k], NULL, port_core_main, (void *)(word_t)k);
+   fn();
+   for(k=1; k<n; k++) pthread_join(th[k], NULL);
+}
+#else
+/**
+ * Single core: runs the function in the calling thread.
+ */
+void
+port_cores_run
+   (uint16_t n,
+   void (*fn)(void))
+{
+   fn();
+}
+#endif
+
+#endif
@@ -0,0 +1,197 @@
+/**
+ * @file port_pic32.c
+ * @brief PIC32 (MIPS M4K) port: context switch, cycle counter and stack setup.
+ *
+ * @author Bruno Basseto (bruno@wise-ware.org)
+ * @version 0
+ */
+
+/********************************************************************************
+ ********************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 1995-2014 Bruno Basseto.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************
+ ********************************************************************************/
+
+#include "chronos.h"
+#include "config.h"
+#include "threads.h"
+
+#ifndef CRONOS_HOST
+#include <mx7/sfr.h>
+
+/*
+ * Global fields for exchanging information between C and assembler.
+ */
+volatile word_t _new_sp;
+
+/**
+ * Change the stack-poiter to return to the thread defined by _new_sp.
+ * @note Assembly function (inline).
+ */
+void switch_threads(void);
+
+/*
+ * Save registers under the stack.
+ */
+_asm("switch_threads:");
+_asm("di");
+_asm("sw $ra, -4($sp)");
+_asm("sw $s7, -8($sp)");
+_asm("sw $s6, -12($sp)");
+_asm("sw $s5, -16($sp)");
+_asm("sw $s4, -20($sp)");
+_asm("sw $s3, -24($sp)");
+_asm("sw $s2, -28($sp)");
+_asm("sw $s1, -32($sp)");
+_asm("sw $s0, -36($sp)");
+_asm("sw $fp, -40($sp)");
+
+/*
+ * Setup new stack-pointer.
+ */
+_asm("lw $sp, _new_sp");
+
+/*
+ * Recover registers belonging to the desired thread.
+ */
+_asm("lw $ra, -4($sp)");
+_asm("lw $s7, -8($sp)");
+_asm("lw $s6, -12($sp)");
+_asm("lw $s5, -16($sp)");
+_asm("lw $s4, -20($sp)");
+_asm("lw $s3, -24($sp)");
+_asm("lw $s2, -28($sp)");
+_asm("lw $s1, -32($sp)");
+_asm("lw $s0, -36($sp)");
+_asm("lw $fp, -40($sp)");
+   
+/*
+ * Returns - processor will go to another thread.
+ */
+_asm("ei");
+_asm("j $ra");
+_asm("ei");
+
+#ifdef CRONOS_PREEMPT
+/**
+ * Preempts the current thread from the tick interrupt (os_tick).
+ * The interrupt prologue has already saved the caller-saved registers, hi/lo, EPC and Status
+ * on the thread stack; kernel_preempt saves the rest with switch_threads.
+ * The interrupt priority level goes down to 0, so that main and the other threads run with all
+ * interrupts; the epilogue restores it when the thread resumes.
+ */
+void
+port_preempt
+   (void)
+{
+   word_t s;
+
+   _asm volatile("di %0" : "=r"(s) :: "memory");
+   s &= ~((7 << 10) | 1);                          // Status.IPL = 0, IE = 0
+   _asm volatile("mtc0 %0, $12, 0; ehb" :: "r"(s) : "memory");
+   kernel_preempt();
+}
+#endif
+
+/**
+ * Wait a number of processor cycles.
+ * @param cycles Number of clock cycles to wait.
+ */
+void delay(uint32_t cycles)
+{
+   _asm("lw $k1, %0" :: "m"(cycles));
+   _asm("mfc0 $k0, $9, 0");                     // load COUNT register.
+   _asm("addu $k1, $k0, $k1");                  // calculate final COUNT register value into $k1 = COUNT + cycles.
+   _asm("_wait_here:");
+   _asm("mfc0 $k0, $9, 0");                     // load COUNT register into $k0.
+   _asm("sub $v0, $k1, $k0");
+   _asm("bgtz $v0, _wait_here");                // wait while $k1 - COUNT >= 0
+   _asm("nop");
+}
+
+/**
+ * Reads the processor cycle counter (CP0 COUNT register).
+ * Default CPU accounting clock source (CYCLE_CLOCK).
+ */
+word_t cycle_count(void)
+{
+   word_t c;
+   _asm volatile("mfc0 %0, $9, 0" : "=r"(c));
+   return c;
+}
+
+#ifdef CRONOS_CLOCK
+/**
+ * Program the one-shot compare of the cycle counter (CP0 Compare, core timer interrupt).
+ * Same priority as the system tick, so that os_compare and os_tick never nest.
+ * A deadline already passed raises the interrupt at once.
+ * @param when Value of the COUNT register for the interrupt.
+ */
+void
+port_compare_set
+   (word_t when)
+{
+   _asm volatile("mtc0 %0, $11, 0; ehb" :: "r"(when));   // writing Compare acknowledges the core timer.
+   IFS0bits.CTIF = 0;
+   IPC0bits.CTIP = 2;
+   IEC0bits.CTIE = 1;
+   if(!TIME_BEFORE(cycle_count(), when)) IFS0bits.CTIF = 1;
+}
+
+/**
+ * Disable the compare interrupt.
+ */
+void
+port_compare_stop
+   (void)
+{
+   IEC0bits.CTIE = 0;
+   IFS0bits.CTIF = 0;
+}
+#endif
+
+/**
+ * Setup the initial stack of a thread: switch_threads will return to the thread entry point.
+ * @param top Stack top (word aligned).
+ * @param thr Thread function entry point.
+ * @return Initial stack pointer.
+ */
+word_t
+port_stack_init
+   (word_t top,
+   void (*thr)(void))
+{
+   _uint32_t addr;
+   byte_t *sp;
+
+   sp = (byte_t *)top;
+   sp--;
+   addr.d = (uint32_t)thr;
+   *sp-- = addr.b[3];
+   *sp-- = addr.b[2];
+   *sp-- = addr.b[1];
+   *sp-- = addr.b[0];
+   return top;
+}
+
+#endif
@@ -0,0 +1,277 @@
+/**
+ * @file queue.c
+ * @brief Zero-copy message queues and mailboxes.
+ *
+ * @author Bruno Basseto (bruno@wise-ware.org)
+ * @version 0
+ */
+
+/********************************************************************************
+ ********************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 1995-2014 Bruno Basseto.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************
+ ********************************************************************************/
+
+#include <stddef.h>
+#include "chronos.h"
+#include "config.h"
+#include "threads.h"
+
+/*
+ * Receivers wait on the queue address, senders on the address of its count.
+ */
+#define RECV_KEY(Q)             ((word_t)(Q))
+#define SEND_KEY(Q)             ((word_t)&(Q)->count)
+
+/**
+ * Initialize a queue.
+ * Messages are pointers, passed without copy: the buffer belongs to the receiver after the transfer.
+ * A word-sized message may be passed by value, cast to a pointer.
+ * @param q Pointer to the queue.
+ * @param buf Ring buffer for size pointers.
+ * @param size Queue capacity (1 = mailbox).
+ */
+void
+queue_init
+   (kqueue_t *q,
+   void **buf,
+   uint16_t size)
+{
+   q->buf = buf;
+   q->size = size;
+   q->head = 0;
+   q->count = 0;
+   q->reserved = 0;
+}
+
+/**
+ * Find the first waiting thread with the highest priority.
+ * Must be called with interrupts disabled.
+ * @param key Wait key (RECV_KEY or SEND_KEY).
+ * @return Thread identifier or NULL.
+ */
+static thread_t*
+queue_waiter
+   (word_t key)
+{
+   thread_t *p, *q;
+
+   q = NULL;
+   list_for_each(_waitq[WAITQ_HASH(key)], p) {
+      if(p->f_semaphore && !p->f_pi) {
+         if(p->data == key) {
+            if((q == NULL) || (p->prio > q->prio)) q = p;
+         }
+      }
+   }
+   return q;
+}
+
+/**
+ * Release a thread waiting on a queue.
+ * Must be called with interrupts disabled.
+ */
+static void
+queue_wake
+   (thread_t *p)
+{
+   thread_unlink(p);
+   p->f_semaphore = FALSE;
+   if(!p->f_time_pending) timer_stop(&p->timer);
+   thread_link(p);
+}
+
+/**
+ * Store a message at the end of a queue, or hand it to a waiting receiver when the queue
+ * is empty and no message from an interrupt handler is still to come.
+ * A receiver still waiting gets the oldest message.
+ * Must be called with interrupts disabled, with a free slot.
+ * @param q Pointer to the queue.
+ * @param msg Message.
+ */
+void
+queue_store
+   (kqueue_t *q,
+   void *msg)
+{
+   thread_t *p;
+   uint16_t i;
+
+   p = queue_waiter(RECV_KEY(q));
+   if((p != NULL) && (q->count == 0) && (q->reserved == 0)) {
+      p->msg = msg;
+      queue_wake(p);
+      return;
+   }
+   i = q->head + q->count;
+   if(i >= q->size) i -= q->size;
+   q->buf[i] = msg;
+   q->count++;
+   if(p != NULL) {
+      queue_get(q, (void **)&p->msg);
+      queue_wake(p);
+   }
+}
+
+/**
+ * Put a message into a queue, or hand it to a waiting receiver.
+ * While messages from interrupt handlers are still to come, the message follows them
+ * through the interrupt event queue, keeping the order of arrival.
+ * Must be called with interrupts disabled.
+ * @param q Pointer to the queue.
+ * @param msg Message.
+ * @return FALSE if the queue is full.
+ */
+bool_t
+queue_put
+   (kqueue_t *q,
+   void *msg)
+{
+   if(q->reserved) return queue_send_from_isr(q, msg);
+   if(q->count + q->reserved >= q->size) return FALSE;
+   queue_store(q, msg);
+   return TRUE;
+}
+
+/**
+ * Take the oldest message of a queue.
+ * The slot released goes to the first waiting sender.
+ * Must be called with interrupts disabled.
+ * @param q Pointer to the queue.
+ * @param msg Message received.
+ * @return FALSE if the queue is empty.
+ */
+bool_t
+queue_get
+   (kqueue_t *q,
+   void **msg)
+{
+   thread_t *p;
+
+   if(q->count == 0) return FALSE;
+   *msg = q->buf[q->head];
+   if(++q->head >= q->size) q->head = 0;
+   q->count--;
+
+   p = queue_waiter(SEND_KEY(q));
+   if((p != NULL) && queue_put(q, p->msg)) queue_wake(p);
+   return TRUE;
+}
+
+/**
+ * Send a message, waiting while the queue is full.
+ * A timeout may be set before with thread_set_timeout().
+ * @param q Pointer to the queue.
+ * @param msg Message.
+ * @return FALSE in case of timeout.
+ */
+bool_t
+queue_send
+   (kqueue_t *q,
+   void *msg)
+{
+   thread_t *th;
+
+   th = (thread_t *)_thrp;
+   if(th == NULL) return queue_trysend(q, msg);  // thread main() cannot wait.
+   th->msg = msg;
+   return kernel_call(SV_QSEND, (word_t)q);
+}
+
+/**
+ * Receive a message, waiting while the queue is empty.
+ * A timeout may be set before with thread_set_timeout().
+ * @param q Pointer to the queue.
+ * @param msg Message received.
+ * @return FALSE in case of timeout.
+ */
+bool_t
+queue_receive
+   (kqueue_t *q,
+   void **msg)
+{
+   thread_t *th;
+
+   th = (thread_t *)_thrp;
+   if(th == NULL) return queue_tryreceive(q, msg);
+   if(!kernel_call(SV_QRECV, (word_t)q)) return FALSE;
+   *msg = th->msg;
+   return TRUE;
+}
+
+/**
+ * Send a message without waiting.
+ * @param q Pointer to the queue.
+ * @param msg Message.
+ * @return FALSE if the queue is full.
+ */
+bool_t
+queue_trysend
+   (kqueue_t *q,
+   void *msg)
+{
+   critical_t cs;
+   bool_t r;
+
+   critical_enter(cs);
+   r = queue_put(q, msg);
+   critical_exit(cs);
+   return r;
+}
+
+/**
+ * Receive a message without waiting.
+ * @param q Pointer to the queue.
+ * @param msg Message received.
+ * @return FALSE if the queue is empty.
+ */
+bool_t
+queue_tryreceive
+   (kqueue_t *q,
+   void **msg)
+{
+   critical_t cs;
+   bool_t r;
+
+   critical_enter(cs);
+   r = queue_get(q, msg);
+   critical_exit(cs);
+   return r;
+}
+
+/**
+ * Suspend the current thread on a queue (SV_QSEND, SV_QRECV).
+ * Must be called with interrupts disabled.
+ * @param q Pointer to the queue.
+ * @param send TRUE for a sender.
+ */
+void
+queue_block
+   (kqueue_t *q,
+   bool_t send)
+{
+   _thrp->f_semaphore = TRUE;
+   _thrp->f_pi = FALSE;
+   _thrp->f_timeout = FALSE;                      // a unit handed over must not be reported as a timeout.
+   _thrp->data = send? SEND_KEY(q) : RECV_KEY(q);
+}
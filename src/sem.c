@@ -0,0 +1,132 @@
+/**
+ * @file sem.c
+ * @brief Counting semaphores.
+ *
+ * @author Bruno Basseto (bruno@wise-ware.org)
+ * @version 0
+ */
+
+/********************************************************************************
+ ********************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 1995-2014 Bruno Basseto.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************
+ ********************************************************************************/
+
+#include <stddef.h>
+#include "chronos.h"
+#include "config.h"
+#include "threads.h"
+
+/**
+ * Initialize a semaphore.
+ * @param s Pointer to the semaphore.
+ * @param count Initial count.
+ * @param max Maximum count (0 = no limit).
+ */
+void
+sem_init
+   (ksem_t *s,
+   word_t count,
+   word_t max)
+{
+   s->count = count;
+   s->max = max;
+}
+
+/**
+ * Take a unit from a semaphore, if there is one.
+ * Must be called with interrupts disabled.
+ * @param s Pointer to the semaphore.
+ * @return FALSE if the count is zero.
+ */
+bool_t
+sem_take
+   (ksem_t *s)
+{
+   if(s->count == 0) return FALSE;
+   s->count--;
+   return TRUE;
+}
+
+/**
+ * Take a unit from a semaphore without blocking.
+ * @param s Pointer to the semaphore.
+ * @return TRUE if the unit was taken.
+ */
+bool_t
+sem_trywait
+   (ksem_t *s)
+{
+   critical_t cs;
+   bool_t r;
+
+   critical_enter(cs);
+   r = sem_take(s);
+   critical_exit(cs);
+   return r;
+}
+
+/**
+ * Give a unit to a semaphore.
+ * If there are waiting threads, the first one with the highest priority gets the unit
+ * directly, without changing the count.
+ * @param s Pointer to the semaphore.
+ * @return FALSE if the count is already at its maximum.
+ */
+bool_t
+sem_post
+   (ksem_t *s)
+{
+   critical_t cs;
+   thread_t *p, *q;
+
+   critical_enter(cs);
+   TRACE(TRACE_UNLOCK, _thrp, s);
+   q = NULL;
+   list_for_each(_waitq[WAITQ_HASH(s)], p) {
+      if(p->f_semaphore && !p->f_pi) {
+         if(p->data == (word_t)s) {
+            if((q == NULL) || (p->prio > q->prio)) q = p;
+         }
+      }
+   }
+   if(q != NULL) {
+      /*
+       * Hand the unit to the waiting thread.
+       */
+      thread_unlink(q);
+      q->f_semaphore = FALSE;
+      if(!q->f_time_pending) timer_stop(&q->timer);
+      thread_link(q);
+      critical_exit(cs);
+      return TRUE;
+   }
+
+   if(s->max && (s->count >= s->max)) {
+      critical_exit(cs);
+      return FALSE;
+   }
+   s->count++;
+   critical_exit(cs);
+   return TRUE;
+}
@@ -0,0 +1,97 @@
+/**
+ * @file simtimer.c
+ * @brief Simulated system timer, for testing the kernel timing off-target.
+ *
+ * @author Bruno Basseto (bruno@wise-ware.org)
+ * @version 0
+ */
+
+/********************************************************************************
+ ********************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 1995-2014 Bruno Basseto.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************
+ ********************************************************************************/
+
+#include "chronos.h"
+#include "config.h"
+#include "timer.h"
+
+#if CRONOS_TIMER == 0
+
+/*
+ * Simulated timer registers.
+ */
+volatile word_t _sim_tmr;
+volatile word_t _sim_pr;
+volatile word_t _sim_con;
+volatile byte_t _sim_if, _sim_ie, _sim_is, _sim_ip, _sim_on;
+
+/**
+ * Number of timer interrupts generated (processor wakeups).
+ */
+volatile uint32_t _sim_irqs;
+
+void os_tick(void);
+
+/**
+ * Advance the simulated timer.
+ * Behaves like the PIC32 type B timers: when TMRx matches PRx it goes back to zero
+ * and the interrupt is requested.
+ * @param counts Number of timer counts to simulate.
+ */
+void
+sim_timer_run
+   (uint32_t counts)
+{
+   word_t n;
+
+   while(counts && _sim_on) {
+      /*
+       * Counts up to the next match.
+       */
+      n = _sim_pr - _sim_tmr;
+      if(counts <= n) {
+         _sim_tmr += counts;
+         return;
+      }
+      counts -= n + 1;
+      _sim_tmr = 0;
+      _sim_if = 1;
+      if(_sim_ie) {
+         _sim_irqs++;
+         os_tick();
+      }
+   }
+}
+
+/**
+ * Idle until the next timer interrupt.
+ */
+void
+sim_timer_idle
+   (void)
+{
+   sim_timer_run(_sim_pr - _sim_tmr + 1);
+}
+
+#endif
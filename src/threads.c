@@ -37,69 +37,87 @@
 #include "config.h"
 #include "threads.h"
 
-/*
- * Global fields for exchanging information between C and assembler.
+/**
+ * Scheduler state of each core (see kcore_t).
+ * Ready queues, one per priority: threads that have already yielded in the current round
+ * are kept at the end of the queue, from nice[prio] on.
+ * ready_map is the bitmap of non-empty ready queues (bit n = priority n).
  */
-volatile word_t _new_sp;
-volatile word_t _old_sp;
+kcore_t _cores[CRONOS_CORES];
 
 /**
- * Threads list.
+ * Threads not ready for execution (sleeping or suspended).
  */
-volatile thread_t *_threads[MAX_PRIO];
-
-volatile thread_t *_thrp;                                ///< Current thread.
-volatile word_t _main_sp;                                ///< Main thread stack pointer backup.
-
+volatile thread_t *_blocked;
 
 /**
- * Change the stack-poiter to return to the thread defined by _new_sp.
- * @note Assembly function (inline).
+ * Threads waiting for a signal or mutex, hashed by the object address.
+ * Signaling an object only looks at the threads in its queue.
  */
-void switch_threads(void);
+volatile thread_t *_waitq[WAITQ_SIZE];
 
-/*
- * Save registers under the stack.
- */
-_asm("switch_threads:");
-_asm("di");
-_asm("sw $ra, -4($sp)");
-_asm("sw $s7, -8($sp)");
-_asm("sw $s6, -12($sp)");
-_asm("sw $s5, -16($sp)");
-_asm("sw $s4, -20($sp)");
-_asm("sw $s3, -24($sp)");
-_asm("sw $s2, -28($sp)");
-_asm("sw $s1, -32($sp)");
-_asm("sw $s0, -36($sp)");
-_asm("sw $fp, -40($sp)");
-
-/*
- * Setup new stack-pointer.
+#ifdef CRONOS_PREEMPT
+/**
+ * Time quantum of each priority, in ticks.
  */
-_asm("lw $sp, _new_sp");
+const uint16_t preempt_quantum[MAX_PRIO] = PREEMPT_QUANTUM;
 
-/*
- * Recover registers belonging to the desired thread.
+/**
+ * Preemption requested by the tick interrupt.
  */
-_asm("lw $ra, -4($sp)");
-_asm("lw $s7, -8($sp)");
-_asm("lw $s6, -12($sp)");
-_asm("lw $s5, -16($sp)");
-_asm("lw $s4, -20($sp)");
-_asm("lw $s3, -24($sp)");
-_asm("lw $s2, -28($sp)");
-_asm("lw $s1, -32($sp)");
-_asm("lw $s0, -36($sp)");
-_asm("lw $fp, -40($sp)");
-   
-/*
- * Returns - processor will go to another thread.
+volatile bool_t _preempt;
+#endif
+
+/**
+ * Setup a thread control block and its stack, and put it into execution.
+ * @param p Thread control block.
+ * @param thr Thread function entry point.
+ * @param sp Stack memory.
+ * @param stack_size Stack size in bytes.
+ * @param flags Initial flags (f_static).
  */
-_asm("ei");
-_asm("j $ra");
-_asm("ei");
+static void
+thread_setup
+   (thread_t *p,
+   void (*thr)(void),
+   byte_t *sp,
+   uint16_t stack_size,
+   uint16_t flags)
+{
+   critical_t cs;
+   word_t *w;
+
+   p->sp0 = (word_t)sp;
+   sp = sp + stack_size;
+   sp = (byte_t*)((word_t)sp & ~(word_t)(STACK_ALIGN - 1));
+   p->stack_size = (uint16_t)((word_t)sp - p->sp0);
 
+   /*
+    * Paint the stack for usage measurement.
+    * The lowest word is the overflow guard.
+    */
+   for(w = (word_t *)p->sp0; w < (word_t *)sp; w++) *w = STACK_PATTERN;
+
+   /*
+    * Setup thread.
+    * Load initial address into the stack.
+    */
+   critical_enter(cs);
+   p->sp = port_stack_init((word_t)sp, thr);
+   p->flags = flags;                               // uses the lowest priority at first.
+   p->base_prio = 0;
+   p->mutexes = NULL;
+   p->core = CORE_ID();
+   p->released = FALSE;
+   p->rel_deadline = 0;
+   p->misses = 0;
+   p->cpu.cycles = 0;
+   p->cpu.runs = 0;
+   p->cpu.max = 0;
+   timer_init(&p->timer, TIMER_THREAD);
+   thread_link(p);
+   critical_exit(cs);
+}
 
 /**
  * Creates a new thread.
@@ -112,47 +130,342 @@ thread_create
    (void (*thr)(void), 
    uint16_t stack_size)
 {
+   critical_t cs;
    thread_t *p;
-   _uint32_t addr;
-   uint16_t i;
    byte_t *sp;
 
    /*
     * Create a new thread ID.
     */
-   p = malloc(sizeof(thread_t));
+   critical_enter(cs);
+   p = pool_alloc(&thread_pool);
+   critical_exit(cs);
    if(p == NULL) return NULL;
 
    /*
     * Allocate thread stack.
     */
+#ifdef CRONOS_PREEMPT
+   critical_enter(cs);                             // main may use the heap while this thread is preempted.
    sp = (byte_t *)malloc(stack_size + 4);
-   if(sp == NULL) return NULL;
-   memset(sp, 0, stack_size + 4);
-   p->sp0 = (uint32_t)sp;
-   stack_size &= 0xfffc;
-   sp = sp + stack_size;
-   sp = (byte_t*)((uint32_t)sp & 0xfffffffc);
+   critical_exit(cs);
+#else
+   sp = (byte_t *)malloc(stack_size + 4);
+#endif
+   if(sp == NULL) {
+      critical_enter(cs);
+      pool_free(&thread_pool, p);
+      critical_exit(cs);
+      return NULL;
+   }
 
-   /*
-    * Setup thread.
-    * Load initial address into the stack.
-    */
-   disable();
-   p->sp = (uint32_t)sp;
-   sp--;
-   addr.d = (uint32_t)thr;
-   *sp-- = addr.b[3];
-   *sp-- = addr.b[2];
-   *sp-- = addr.b[1];
-   *sp-- = addr.b[0];
-   
-   p->flags = 0;
-   list_add(&_threads[0], p);                      // uses the lowest priority at first.
-   enable();
+   thread_setup(p, thr, sp, stack_size & 0xfffc, 0);
    return p;
 }
 
+/**
+ * Creates a new thread using memory provided by the caller, without any heap allocation.
+ * The storage must remain valid while the thread exists (see CHRONOS_THREAD_DEFINE).
+ * @param th Thread control block.
+ * @param thr Thread function entry point.
+ * @param stack Stack memory for the new thread (word aligned).
+ * @param stack_size Stack size in bytes.
+ * @return Thread identifier (= th).
+ */
+thread_t*
+thread_create_static
+   (thread_t *th,
+   void (*thr)(void),
+   void *stack,
+   uint16_t stack_size)
+{
+   if((th == NULL) || (stack == NULL)) return NULL;
+
+   thread_setup(th, thr, (byte_t *)stack, stack_size, MASK_STATIC);
+   return th;
+}
+
+/**
+ * Setup a stackless task and put it into execution.
+ * @param p Task control block.
+ * @param fn Task function, called with p at each run.
+ * @param flags Initial flags (f_static).
+ */
+static void
+task_setup
+   (thread_t *p,
+   void (*fn)(void *),
+   uint16_t flags)
+{
+   critical_t cs;
+
+   critical_enter(cs);
+   p->lc = 0;
+   p->task = fn;
+   p->stack_size = 0;
+   p->flags = flags | MASK_TASK;                   // uses the lowest priority at first.
+   p->base_prio = 0;
+   p->mutexes = NULL;
+   p->core = CORE_ID();
+   p->released = FALSE;
+   p->rel_deadline = 0;
+   p->misses = 0;
+   p->cpu.cycles = 0;
+   p->cpu.runs = 0;
+   p->cpu.max = 0;
+   timer_init(&p->timer, TIMER_THREAD);
+   thread_link(p);
+   critical_exit(cs);
+}
+
+/**
+ * Creates a new stackless task (see TASK_BEGIN).
+ * The task runs on the main stack: only its control block is allocated.
+ * @param fn Task function, called with the task identifier.
+ * @return Task identifier (a thread_t, accepted by the thread API).
+ */
+thread_t*
+task_create
+   (void (*fn)(void *))
+{
+   critical_t cs;
+   thread_t *p;
+
+   critical_enter(cs);
+   p = pool_alloc(&thread_pool);
+   critical_exit(cs);
+   if(p == NULL) return NULL;
+
+   task_setup(p, fn, 0);
+   return p;
+}
+
+/**
+ * Creates a new stackless task using a control block provided by the caller.
+ * The block may be the first member of a larger application structure, passed to fn.
+ * @param th Task control block.
+ * @param fn Task function, called with th.
+ * @return Task identifier (= th).
+ */
+thread_t*
+task_create_static
+   (thread_t *th,
+   void (*fn)(void *))
+{
+   if(th == NULL) return NULL;
+
+   task_setup(th, fn, MASK_STATIC);
+   return th;
+}
+
+/**
+ * Insert a thread into the scheduler queue corresponding to its state.
+ * Must be called with interrupts disabled, after changing the thread flags or priority.
+ * The current thread is not queued while running.
+ * @param th Thread identifier.
+ */
+void
+thread_link
+   (thread_t *th)
+{
+   kcore_t *c;
+   uint8_t prio;
+
+   if(th->f_queued) return;
+   c = &_cores[th->core];
+   if(th == c->thrp) return;
+   th->f_queued = TRUE;
+
+   if(th->flags & MASK_TIMEOUT) {
+      /*
+       * Waiting for an object.
+       */
+      EDF_END(th);
+      list_add(&_waitq[WAITQ_HASH(th->data)], th);
+      return;
+   }
+   if(th->flags & MASK_WAIT) {
+      /*
+       * Not ready.
+       */
+      EDF_END(th);
+      list_add(&_blocked, th);
+      return;
+   }
+
+   EDF_RELEASE(th);
+   prio = th->prio;
+#ifdef CRONOS_EDF
+   if((prio == EDF_PRIO) && th->rel_deadline) {
+      /*
+       * Ordered by deadline, ahead of the threads without one.
+       */
+      edf_link(c, th);
+      return;
+   }
+#endif
+   if(th->f_nice) {
+      /*
+       * Yielded: goes to the end of the queue.
+       */
+      list_add(&c->threads[prio], th);
+      if(c->nice[prio] == NULL) c->nice[prio] = th;
+   } else {
+      /*
+       * Goes before the threads that have yielded.
+       */
+      if(c->nice[prio] == NULL) list_add(&c->threads[prio], th);
+      else list_insert(&c->threads[prio], (thread_t *)c->nice[prio], th);
+   }
+   c->ready_map |= PRIO_BIT(prio);
+}
+
+/**
+ * Remove a thread from its scheduler queue.
+ * Must be called with interrupts disabled, before changing the thread flags or priority.
+ * @param th Thread identifier.
+ */
+void
+thread_unlink
+   (thread_t *th)
+{
+   kcore_t *c;
+   uint8_t prio;
+
+   if(!th->f_queued) return;
+   th->f_queued = FALSE;
+
+   if(th->flags & MASK_TIMEOUT) {
+      list_remove(&_waitq[WAITQ_HASH(th->data)], th);
+      return;
+   }
+   if(th->flags & MASK_WAIT) {
+      list_remove(&_blocked, th);
+      return;
+   }
+
+   c = &_cores[th->core];
+   prio = th->prio;
+   th->f_nice = FALSE;
+   if(c->nice[prio] == th) c->nice[prio] = th->list.next;
+   list_remove(&c->threads[prio], th);
+   if(c->threads[prio] == NULL) c->ready_map &= ~PRIO_BIT(prio);
+}
+
+/**
+ * Select the next thread of the current round, from the highest ready priority down.
+ * Must be called with interrupts disabled.
+ * @return Priority of the selected thread (first in its queue), or -1 if all threads were serviced.
+ */
+static int
+thread_next
+   (void)
+{
+   kcore_t *c;
+   int i;
+   word_t map;
+
+   c = _core;
+   map = c->ready_map;
+   while(map) {
+      i = HIGHEST_BIT(map);
+      if(c->threads[i] != c->nice[i]) return i;            // a thread not serviced in this round.
+      c->nice[i] = NULL;                                   // all threads serviced, new round.
+      map &= ~PRIO_BIT(i);                                 // lower priorities allowed to come in.
+   }
+   return -1;
+}
+
+#if CRONOS_CORES > 1
+/**
+ * Any ready thread in any core?
+ * Read without the kernel lock, only a hint.
+ */
+static bool_t
+thread_ready_any
+   (void)
+{
+   uint16_t k;
+
+   for(k=0; k<CRONOS_CORES; k++) {
+      if(_cores[k].ready_map) return TRUE;
+   }
+   return FALSE;
+}
+
+/**
+ * Take a ready thread from the core with the highest ready priority.
+ * The last thread of the queue is taken: it is the one that would wait longer there.
+ * Must be called with interrupts disabled, when the current core has no ready threads.
+ * @return Priority of the thread, now first in our queue, or -1 if there is nothing to steal.
+ */
+static int
+thread_steal
+   (void)
+{
+   kcore_t *c, *v;
+   thread_t *th;
+   uint16_t k, me;
+   int i, best;
+
+   me = CORE_ID();
+   v = NULL;
+   best = -1;
+   for(k=0; k<CRONOS_CORES; k++) {
+      c = &_cores[k];
+      if((k == me) || (c->ready_map == 0)) continue;
+      i = HIGHEST_BIT(c->ready_map);
+      if(i > best) {
+         best = i;
+         v = c;
+      }
+   }
+   if(v == NULL) return -1;
+
+   th = (thread_t *)v->threads[best];
+   if(th->list.prev != NULL) th = th->list.prev;
+   thread_unlink(th);
+   th->core = me;
+   thread_link(th);
+   return best;
+}
+#endif
+
+/**
+ * Runs the current task, on the main stack, until it waits or returns.
+ * Called by the scheduler with interrupts disabled.
+ */
+static void
+task_run
+   (void)
+{
+   thread_t *p;
+   word_t t;
+
+   p = (thread_t *)_thrp;
+   enable();
+   p->task(p);
+   disable();                                      // may be disabled already by task_call().
+
+#ifdef CRONOS_ACCOUNTING
+   t = CYCLE_CLOCK() - _run_start;
+   CPU_ACCOUNT(&p->cpu, t);
+#endif
+   _thrp = NULL;
+   TRACE(TRACE_RETURN, p, 0);
+   if(_zombie == p) {
+      _zombie = NULL;
+      if(!p->f_static) pool_free(&thread_pool, p);
+   } else {
+      /*
+       * Returned without waiting: same as a yield.
+       */
+      if(!(p->flags & MASK_WAIT)) p->f_nice = TRUE;
+      thread_link(p);
+   }
+   enable();
+}
+
 /**
  * Scheduler entry point.
  * Must be called by the main loop.
@@ -162,49 +475,70 @@ scheduler
    (void)
 {
    int i;
-   uint8_t p;
-   static void (*c)(void *);
-   callback_t *cb;
+
+#if CRONOS_CORES > 1
+   /*
+    * Idle cores look around without taking the kernel lock.
+    */
+   if((CORE_ID() != 0) && !thread_ready_any()) return;
+#endif
+
+#ifdef CRONOS_LOAD
+   /*
+    * End of the idle period, CPU load (core 0).
+    */
+   if(CORE_ID() == 0) load_account();
+#endif
+
+   /*
+    * 0. Events posted by interrupt handlers (core 0).
+    */
+   if((CORE_ID() == 0) && ISRQ_PENDING()) isr_drain();
+#ifdef CRONOS_CLOCK
+   if(CORE_ID() == 0) PORT_COMPARE_POLL();
+#endif
 
    /*
-    * 1. Execute callbacks.
+    * 1. Execute callbacks (core 0).
     */
    disable();
-tenta:
-   list_for_each(_callbacks, cb) {
-      if(cb->timer == 0) {
-         /*
-          * Callback is ready to be called.
-          */
-         c = cb->function;
-         enable();
-         c(cb->param);
-         disable();
-         free(cb);
-         list_remove(&_callbacks, cb);
-         goto tenta;
-      }
-   }
+   if(CORE_ID() == 0) callback_dispatch();
    
    /*
-    * 2. Look for the next thread.
+    * 2. Look for the next thread, from the highest ready priority down.
     */
-   for(i = MAX_PRIO-1; i >= 0; i--) {
-      list_for_each(_threads[i], _thrp) {
-         if(_thrp->f_nice) continue;                        // other threads allowed to come in.
-         if((_thrp->flags & MASK_WAIT) == 0)                // ready?
-            goto ready;
-      }
-      list_for_each(_threads[i], _thrp) {                   // all threads serviced, clears f_nice.
-         _thrp->f_nice = FALSE;
-      }
+   i = thread_next();
+   if(i >= 0) goto ready;
+   if(_ready_map) {
+      i = HIGHEST_BIT(_ready_map);
+      goto ready;
    }
+#if CRONOS_CORES > 1
+   i = thread_steal();
+   if(i >= 0) goto ready;
+#endif
    
    /*
     * No threads.
+    * Callbacks made due during the dispatch pass, and interrupt events, run on the next
+    * pass: the processor must not idle with them.
     */
    _thrp = NULL;
+   TRACE(TRACE_IDLE, NULL, 0);
+   if((CORE_ID() != 0) || (_callbacks != NULL) || ISRQ_PENDING()) {
+      enable();
+      return;
+   }
+#ifdef CRONOS_LOAD
+   load_idle();
+#endif
+#ifdef CRONOS_TICKLESS
+   kernel_idle();
    enable();
+#else
+   enable();
+   idle_hook();
+#endif
    return;
 
 ready:
@@ -212,55 +546,92 @@ ready:
     * Switch to the chosen thread.
     */
    disable();
-   _asm("sw $sp, %0" : "=m"(_main_sp));
-   _new_sp = _thrp->sp;
-   switch_threads();
+   _thrp = _threads[i];
+   thread_unlink((thread_t *)_thrp);
+   TRACE(TRACE_SWITCH, _thrp, i);
+#ifdef CRONOS_ACCOUNTING
+   _run_start = CYCLE_CLOCK();
+#endif
+   PREEMPT_RELOAD(_thrp);
+   if(_thrp->f_task) {
+      task_run();
+      return;
+   }
+   SWITCH_CONTEXT(_main_sp, _thrp->sp);
+
+   /*
+    * Back to main: release a thread that has ended, now that its stack is no longer in use.
+    */
+   if(_zombie != NULL) {
+      disable();
+      if(!_zombie->f_static) {
+         free((void*)_zombie->sp0);
+         pool_free(&thread_pool, (void *)_zombie);
+      }
+      _zombie = NULL;
+      enable();
+   }
 }
 
 /**
- * Kernel services entry-point.
- * This function may not return immediately to the calling thread, if it gets suspended.
- * In this case, it returns to main therad.
+ * Outcome of a kernel service (kernel_service).
+ */
+#define KS_RETURN               0                 // back to the caller, TRUE.
+#define KS_FAIL                 1                 // back to the caller, FALSE.
+#define KS_BLOCK                2                 // the caller leaves the CPU.
+#define KS_END                  3                 // the caller has ended.
+
+/**
+ * Executes a kernel service on behalf of the current thread or task.
+ * Must be called with interrupts disabled.
  * @param func Kernel function code.
  * @param arg Kernel function parameter.
- * @return FALSE in case of failure or timeout.
+ * @return What the caller must do next (KS_xxx).
  */
-bool_t 
-kernel_call
-   (uint16_t func, 
+static inline int __attribute__((always_inline))
+kernel_service
+   (uint16_t func,
    word_t arg)
 {
-   if(_thrp == NULL) return FALSE;                // thread main() cannot ask for kernel services.
+   kmutex_t *m;
 
-   /*
-    * Identify kernel function.
-    */
-   disable();
+   TRACE(TRACE_SERVICE + func, _thrp, arg);
    switch(func) {
       /*
        * thread_yield
        */
       case SV_YIELD:
          _thrp->f_nice = TRUE;
-         goto return_to_main;
+         return KS_BLOCK;
 
       /*
        * thread_end
        */
       case SV_END:
-         free((void*)_thrp->sp0);
-         arg = _thrp->prio;
-         free(_thrp);
-         list_remove(&_threads[arg], _thrp);
-         goto return_to_main;
+         timer_stop((ktimer_t *)&_thrp->timer);
+         mutex_release_all((thread_t *)_thrp);
+         return KS_END;
 
       /*
        * thread_sleep
        */
       case SV_SLEEP:
-         _thrp->timer = arg;
+         timer_start((ktimer_t *)&_thrp->timer, arg);
+         _thrp->f_time_pending = TRUE;
+         return KS_BLOCK;
+
+      /*
+       * thread_sleep_until: absolute tick, a past one only yields.
+       */
+      case SV_SLEEPUNTIL:
+         arg = (uint32_t)(arg - ticks);
+         if((arg == 0) || (arg & 0x80000000)) {
+            _thrp->f_nice = TRUE;
+            return KS_BLOCK;
+         }
+         timer_start((ktimer_t *)&_thrp->timer, arg);
          _thrp->f_time_pending = TRUE;
-         goto return_to_main;
+         return KS_BLOCK;
 
       /*
        * thread_wait
@@ -268,15 +639,33 @@ kernel_call
       case SV_WAIT:
          _thrp->f_waiting = TRUE;
          _thrp->data = arg;
-         goto return_to_main;
+         return KS_BLOCK;
 
       /*
        * thread_set_timeout
        */
       case SV_SETTIMEOUT:
-         _thrp->timer = arg;
+         timer_start((ktimer_t *)&_thrp->timer, arg);
          _thrp->f_timeout = FALSE;
-         goto return_to_thread;
+         return KS_RETURN;
+
+#ifdef CRONOS_CLOCK
+      /*
+       * thread_sleep_cycles, thread_sleep_ns (shorter than one tick)
+       */
+      case SV_HRSLEEP:
+         timer_start_hr((ktimer_t *)&_thrp->timer, arg);
+         _thrp->f_time_pending = TRUE;
+         return KS_BLOCK;
+
+      /*
+       * thread_set_timeout_cycles, thread_set_timeout_ns (shorter than one tick)
+       */
+      case SV_HRTIMEOUT:
+         timer_start_hr((ktimer_t *)&_thrp->timer, arg);
+         _thrp->f_timeout = FALSE;
+         return KS_RETURN;
+#endif
 
       /*
        * thread_lock
@@ -290,38 +679,184 @@ kernel_call
              * Already locked, suspend thread.
              */
             _thrp->f_semaphore = TRUE;
+            _thrp->f_pi = FALSE;
             _thrp->data = arg;
-            goto return_to_main;
+            return KS_BLOCK;
          }
             
          /*
           * Lock and return to thread.
           */
          *(byte_t *)arg = 1;
-         goto return_to_thread_no_timeout;
+         break;
+
+      /*
+       * mutex_lock
+       */
+      case SV_MLOCK:
+         m = (kmutex_t *)arg;
+         if(m->owner == NULL) {
+            /*
+             * Free, lock and return to thread.
+             */
+            mutex_take(m, (thread_t *)_thrp);
+            break;
+         }
+         if(m->owner == _thrp) {
+            /*
+             * Already ours.
+             */
+            if(!m->recursive) return KS_FAIL;
+            m->count++;
+            break;
+         }
+
+         /*
+          * Locked by another thread: suspend and lend our priority to the owner.
+          */
+         _thrp->f_semaphore = TRUE;
+         _thrp->f_pi = TRUE;
+         _thrp->data = arg;
+         mutex_inherit(m, _thrp->prio);
+         return KS_BLOCK;
+
+      /*
+       * sem_wait
+       */
+      case SV_SEMWAIT:
+         if(sem_take((ksem_t *)arg)) break;
+         _thrp->f_semaphore = TRUE;
+         _thrp->f_pi = FALSE;
+         _thrp->f_timeout = FALSE;
+         _thrp->data = arg;
+         return KS_BLOCK;
+
+      /*
+       * event_wait
+       */
+      case SV_EVWAIT:
+         if(event_take((kevent_t *)arg, (thread_t *)_thrp)) break;
+         _thrp->f_semaphore = TRUE;
+         _thrp->f_pi = FALSE;
+         _thrp->f_timeout = FALSE;
+         _thrp->data = arg;
+         return KS_BLOCK;
+
+      /*
+       * queue_send
+       */
+      case SV_QSEND:
+         if(queue_put((kqueue_t *)arg, _thrp->msg)) break;
+         queue_block((kqueue_t *)arg, TRUE);
+         return KS_BLOCK;
+
+      /*
+       * queue_receive
+       */
+      case SV_QRECV:
+         if(queue_get((kqueue_t *)arg, (void **)&_thrp->msg)) break;
+         queue_block((kqueue_t *)arg, FALSE);
+         return KS_BLOCK;
    }
 
-return_to_thread_no_timeout:
+   /*
+    * Got it without waiting: cancels timeout checking.
+    */
    if(!_thrp->f_time_pending)
-      _thrp->timer = 0;                      // cancels timeout checking
+      timer_stop((ktimer_t *)&_thrp->timer);
+   return KS_RETURN;
+}
 
-return_to_thread:
-   enable();
-   return TRUE;
+/**
+ * Kernel services entry-point.
+ * This function may not return immediately to the calling thread, if it gets suspended.
+ * In this case, it returns to main therad.
+ * @param func Kernel function code.
+ * @param arg Kernel function parameter.
+ * @return FALSE in case of failure or timeout.
+ */
+bool_t 
+kernel_call
+   (uint16_t func, 
+   word_t arg)
+{
+   thread_t *p;
+   word_t t;
+   int i;
+
+   if(_thrp == NULL) return FALSE;                // thread main() cannot ask for kernel services.
+
+   /*
+    * Identify kernel function.
+    */
+   disable();
+   switch(kernel_service(func, arg)) {
+      case KS_RETURN:
+         enable();
+         return TRUE;
+
+      case KS_FAIL:
+         enable();
+         return FALSE;
+
+      case KS_END:
+#ifdef CRONOS_STACK_CHECK
+         GET_SP(_old_sp);
+         if(!STACK_GUARD_OK(_thrp) || (_old_sp < _thrp->sp0 + STACK_FRAME + 4)) stack_overflow((thread_t *)_thrp);
+#endif
+#ifdef CRONOS_ACCOUNTING
+         t = CYCLE_CLOCK() - _run_start;
+         CPU_ACCOUNT(&_thrp->cpu, t);
+#endif
+         _zombie = _thrp;                          // released by the scheduler, out of this stack.
+         _thrp = NULL;
+         SWITCH_CONTEXT(_old_sp, _main_sp);
+         unreachable();
+   }
 
-return_to_main:
    /*
     * Save current thread stack pointer.
     */
-   _asm("sw $sp, %0" : "=m"(_old_sp));
-   _thrp->sp = _old_sp;
+   GET_SP(_old_sp);
+#ifdef CRONOS_STACK_CHECK
+   if(!STACK_GUARD_OK(_thrp) || (_old_sp < _thrp->sp0 + STACK_FRAME + 4)) stack_overflow((thread_t *)_thrp);
+#endif
+#ifdef CRONOS_ACCOUNTING
+   t = CYCLE_CLOCK() - _run_start;
+   CPU_ACCOUNT(&_thrp->cpu, t);
+#endif
 
    /*
-    * Retorns to thread main().
+    * Put the thread back into the scheduler queues.
     */
+   p = (thread_t *)_thrp;
    _thrp = NULL;
-   _new_sp = _main_sp;
-   switch_threads();
+   thread_link(p);
+   TRACE(TRACE_RETURN, p, func);
+
+#ifdef CRONOS_HANDOFF
+   /*
+    * Fast path: switch directly to the next thread of this round.
+    * Main runs the due callbacks, interrupt events and tasks, idles and starts a new round.
+    */
+   i = ((CORE_ID() == 0) && ((_callbacks != NULL) || ISRQ_PENDING()))? -1 : thread_next();
+   if((i >= 0) && !_threads[i]->f_task) {
+      _thrp = _threads[i];
+      thread_unlink((thread_t *)_thrp);
+      TRACE(TRACE_SWITCH, _thrp, i);
+#ifdef CRONOS_ACCOUNTING
+      _run_start = CYCLE_CLOCK();
+#endif
+      PREEMPT_RELOAD(_thrp);
+      SWITCH_CONTEXT(p->sp, _thrp->sp);
+   }
+   else
+#endif
+
+   /*
+    * Retorns to thread main().
+    */
+   SWITCH_CONTEXT(p->sp, _main_sp);
 
    /*
     * When a thread is going to be executed again we came from here.
@@ -330,3 +865,86 @@ return_to_main:
    if(_thrp->f_timeout) return FALSE;
    return TRUE;
 }
+
+#ifdef CRONOS_PREEMPT
+/**
+ * Takes the CPU from the current thread, back to main (CRONOS_PREEMPT).
+ * Called by the port at the end of the tick interrupt, with interrupts disabled, when the whole
+ * register context of the thread is already saved on its stack (interrupt frame; signal frame
+ * on the host). The thread goes back to its ready queue, to the end of the round if its quantum
+ * is over, and returns from here when it is scheduled again.
+ */
+void
+kernel_preempt
+   (void)
+{
+   thread_t *p;
+   word_t t;
+
+   _preempt = FALSE;
+   p = (thread_t *)_thrp;
+   if((p == NULL) || p->f_task) {
+      /*
+       * Main or a task (main stack): the scheduler runs next anyway.
+       */
+      enable();
+      return;
+   }
+
+   /*
+    * The interrupt (signal) frame is on the thread stack.
+    */
+#ifdef CRONOS_STACK_CHECK
+   GET_SP(_old_sp);
+   if(!STACK_GUARD_OK(p) || (_old_sp < p->sp0 + STACK_FRAME + 4)) stack_overflow(p);
+#endif
+#ifdef CRONOS_ACCOUNTING
+   t = CYCLE_CLOCK() - _run_start;
+   CPU_ACCOUNT(&p->cpu, t);
+#endif
+   if(_slice == 0) p->f_nice = TRUE;
+   _thrp = NULL;
+   thread_link(p);
+   TRACE(TRACE_PREEMPT, p, 0);
+   SWITCH_CONTEXT(p->sp, _main_sp);
+}
+#endif
+
+/**
+ * Kernel services entry-point for stackless tasks (TASK_CALL).
+ * The service runs on the main stack; when it blocks, the task function must return
+ * and the scheduler puts the task back into its queue. Interrupts are kept disabled up to then,
+ * so that no signal gets lost before the task is queued.
+ * @param func Kernel function code.
+ * @param arg Kernel function parameter.
+ * @return TRUE if the task must return to the scheduler, FALSE to go on (result in f_timeout).
+ */
+bool_t
+task_call
+   (uint16_t func,
+   word_t arg)
+{
+   bool_t r;
+
+   if((_thrp == NULL) || !_thrp->f_task) return TRUE;
+
+   disable();
+   r = TRUE;
+   switch(kernel_service(func, arg)) {
+      case KS_RETURN:
+         _thrp->f_timeout = FALSE;
+         r = FALSE;
+         break;
+
+      case KS_FAIL:
+         _thrp->f_timeout = TRUE;
+         r = FALSE;
+         break;
+
+      case KS_END:
+         _zombie = _thrp;                          // released by task_run().
+         break;
+   }
+   if(!r) enable();
+   return r;
+}
@@ -0,0 +1,253 @@
+/**
+ * @file timers.c
+ * @brief Kernel timers, kept in a sorted delta list.
+ *
+ * @author Bruno Basseto (bruno@wise-ware.org)
+ * @version 0
+ */
+
+/********************************************************************************
+ ********************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 1995-2014 Bruno Basseto.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************
+ ********************************************************************************/
+
+#include <stdlib.h>
+#include "chronos.h"
+#include "config.h"
+#include "threads.h"
+
+/**
+ * Delta list of active timers.
+ * Each element stores the number of ticks after the expiration of the previous one,
+ * so the tick interrupt only needs to look at the head of the list.
+ */
+ktimer_t *_timers;
+
+#ifdef CRONOS_CLOCK
+/**
+ * Timers shorter than one tick, waiting for the cycle counter compare.
+ * Sorted by absolute deadline (cycle_count), kept in the delta field; the compare
+ * is programmed to the head of the list.
+ */
+ktimer_t *_hrtimers;
+#endif
+
+/**
+ * Start (or restart) a timer.
+ * Must be called with interrupts disabled.
+ * @param t Timer to start.
+ * @param time Number of ticks before expiration (0 = do not start).
+ */
+void
+timer_start
+   (ktimer_t *t,
+   word_t time)
+{
+   ktimer_t *p, *q;
+
+   if(t->active) timer_stop(t);
+   if(time == 0) return;
+
+   /*
+    * Find the position, consuming the deltas of the timers expiring before.
+    * Timers with the same deadline are kept in FIFO order.
+    */
+   q = NULL;
+   for(p = _timers; p != NULL; p = p->next) {
+      if(time < p->delta) {
+         p->delta -= time;
+         break;
+      }
+      time -= p->delta;
+      q = p;
+   }
+
+   /*
+    * Insert between q and p.
+    */
+   t->delta = time;
+   t->prev = q;
+   t->next = p;
+   if(p != NULL) p->prev = t;
+   if(q != NULL) q->next = t;
+   else _timers = t;
+   t->active = TRUE;
+}
+
+/**
+ * Stop a timer, removing it from the delta list.
+ * Must be called with interrupts disabled.
+ * @param t Timer to stop.
+ */
+void
+timer_stop
+   (ktimer_t *t)
+{
+   ktimer_t *p, *q;
+
+   if(!t->active) return;
+   p = t->next;
+   q = t->prev;
+
+#ifdef CRONOS_CLOCK
+   if(t->active == TIMER_HR) {
+      /*
+       * Absolute deadlines, nothing to inherit.
+       * A compare left for a removed head only causes a spurious interrupt.
+       */
+      t->active = FALSE;
+      if(p != NULL) p->prev = q;
+      if(q != NULL) q->next = p;
+      else _hrtimers = p;
+      if(_hrtimers == NULL) port_compare_stop();
+      return;
+   }
+#endif
+
+   t->active = FALSE;
+   if(p != NULL) {
+      /*
+       * Next timer inherits our delta.
+       */
+      p->delta += t->delta;
+      p->prev = q;
+   }
+   if(q != NULL) q->next = p;
+   else _timers = p;
+}
+
+/**
+ * Count elapsed ticks.
+ * Called by the system tick interrupt, only the timers expiring are touched.
+ * @param n Number of ticks elapsed since the last call.
+ */
+void
+timer_tick
+   (word_t n)
+{
+   ktimer_t *t;
+
+   for(t = _timers; (t != NULL) && n; t = t->next) {
+      if(t->delta >= n) {
+         t->delta -= n;
+         return;
+      }
+      n -= t->delta;
+      t->delta = 0;
+   }
+}
+
+/**
+ * Number of ticks before the next timer expiration.
+ * @return Ticks to the first timer of the list (0 = no active timers).
+ */
+word_t
+timer_next
+   (void)
+{
+   if(_timers == NULL) return 0;
+   return _timers->delta;
+}
+
+/**
+ * Remove the first expired timer from the list.
+ * Called by the system tick interrupt after timer_tick(), until it returns NULL.
+ * @return Expired timer or NULL if there are no more timers to expire now.
+ */
+ktimer_t*
+timer_expired
+   (void)
+{
+   ktimer_t *t;
+
+   t = _timers;
+   if(t == NULL) return NULL;
+   if(t->delta) return NULL;
+
+   _timers = t->next;
+   if(_timers != NULL) _timers->prev = NULL;
+   t->active = FALSE;
+   return t;
+}
+
+#ifdef CRONOS_CLOCK
+/**
+ * Start (or restart) a timer on the cycle counter compare, for deadlines shorter than one tick.
+ * Must be called with interrupts disabled.
+ * @param t Timer to start.
+ * @param cycles Number of cycle_count() cycles before expiration (up to half the counter range).
+ */
+void
+timer_start_hr
+   (ktimer_t *t,
+   word_t cycles)
+{
+   ktimer_t *p, *q;
+   word_t when;
+
+   if(t->active) timer_stop(t);
+   when = cycle_count() + cycles;
+
+   /*
+    * Timers with the same deadline are kept in FIFO order.
+    */
+   q = NULL;
+   for(p = _hrtimers; p != NULL; p = p->next) {
+      if(TIME_BEFORE(when, p->delta)) break;
+      q = p;
+   }
+
+   t->delta = when;
+   t->prev = q;
+   t->next = p;
+   if(p != NULL) p->prev = t;
+   if(q != NULL) q->next = t;
+   else {
+      _hrtimers = t;
+      port_compare_set(when);
+   }
+   t->active = TIMER_HR;
+}
+
+/**
+ * Remove the first expired timer from the compare list.
+ * Called by the compare interrupt until it returns NULL.
+ * @return Expired timer or NULL if there are no more timers to expire now.
+ */
+ktimer_t*
+timer_hr_expired
+   (void)
+{
+   ktimer_t *t;
+
+   t = _hrtimers;
+   if(t == NULL) return NULL;
+   if(TIME_BEFORE(cycle_count(), t->delta)) return NULL;
+
+   _hrtimers = t->next;
+   if(_hrtimers != NULL) _hrtimers->prev = NULL;
+   t->active = FALSE;
+   return t;
+}
+#endif
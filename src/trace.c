@@ -0,0 +1,67 @@
+/**
+ * @file trace.c
+ * @brief Binary trace of scheduler events.
+ *
+ * @author Bruno Basseto (bruno@wise-ware.org)
+ * @version 0
+ */
+
+/********************************************************************************
+ ********************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 1995-2014 Bruno Basseto.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************
+ ********************************************************************************/
+
+#include "chronos.h"
+#include "config.h"
+#include "threads.h"
+
+#ifdef CRONOS_TRACE
+
+/**
+ * Trace ring buffer.
+ * Records are written by the TRACE() macro, trace_head counts all records ever written.
+ */
+trace_rec_t trace_buffer[TRACE_SIZE];
+volatile uint32_t trace_head;
+
+/**
+ * Sends the trace buffer to the host, for decoding with tools/tracedump.
+ * Output: header (magic, head, size, record size), then the raw ring buffer.
+ * @param out Function that writes data to the host (UART, debugger, file...).
+ */
+void
+trace_dump
+   (void (*out)(void *data, word_t len))
+{
+   uint32_t hdr[4];
+
+   hdr[0] = TRACE_MAGIC;
+   hdr[1] = trace_head;
+   hdr[2] = TRACE_SIZE;
+   hdr[3] = sizeof(trace_rec_t);
+   out(hdr, sizeof(hdr));
+   out(trace_buffer, sizeof(trace_buffer));
+}
+
+#endif
@@ -0,0 +1,239 @@
+/**
+ * @file tracedump.c
+ * @brief Host decoder for the cronOS scheduler trace (trace_dump output).
+ *
+ * Usage: tracedump [-j] [-f hz] dump.bin
+ *    -j    Chrome trace JSON output (chrome://tracing, Perfetto).
+ *    -f    Frequency of the trace clock in Hz (default 40000000).
+ *
+ * @author Bruno Basseto (bruno@wise-ware.org)
+ * @version 0
+ */
+
+/********************************************************************************
+ ********************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 1995-2014 Bruno Basseto.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************
+ ********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/*
+ * Must match trace_rec_t and the TRACE_xxx codes in chronos.h.
+ */
+#define TRACE_MAGIC             0x43525443
+#define TRACE_REC_SIZE          16
+
+#define TRACE_SWITCH            1
+#define TRACE_RETURN            2
+#define TRACE_IDLE              3
+#define TRACE_SIGNAL            4
+#define TRACE_UNLOCK            5
+#define TRACE_CB_FIRE           6
+#define TRACE_CB_RUN            7
+#define TRACE_CB_END            8
+#define TRACE_TICK              9
+#define TRACE_PREEMPT           10
+#define TRACE_SERVICE           16
+
+typedef struct {
+   uint32_t time;
+   uint32_t thread;
+   uint32_t object;
+   uint8_t event;
+} rec_t;
+
+static const char *services[] = {
+   "yield", "sleep", "set_timeout", "wait", "signal", "lock", "unlock", "mutex_lock", "sv8", "end", "sem_wait", "event_wait", "queue_send", "queue_receive", "hr_sleep", "hr_timeout", "sleep_until"
+};
+
+/**
+ * Reads a little-endian 32-bit value.
+ */
+static uint32_t
+le32
+   (const uint8_t *p)
+{
+   return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+ * Event name.
+ */
+static const char *
+event_name
+   (uint8_t ev)
+{
+   static char buf[32];
+
+   switch(ev) {
+      case TRACE_SWITCH: return "switch";
+      case TRACE_RETURN: return "return";
+      case TRACE_IDLE: return "idle";
+      case TRACE_SIGNAL: return "signal";
+      case TRACE_UNLOCK: return "unlock";
+      case TRACE_CB_FIRE: return "cb_fire";
+      case TRACE_CB_RUN: return "cb_run";
+      case TRACE_CB_END: return "cb_end";
+      case TRACE_TICK: return "tick";
+      case TRACE_PREEMPT: return "preempt";
+   }
+   if(ev >= TRACE_SERVICE) {
+      if((size_t)(ev - TRACE_SERVICE) < sizeof(services) / sizeof(services[0]))
+         snprintf(buf, sizeof(buf), "call %s", services[ev - TRACE_SERVICE]);
+      else snprintf(buf, sizeof(buf), "call %u", ev - TRACE_SERVICE);
+      return buf;
+   }
+   snprintf(buf, sizeof(buf), "event %u", ev);
+   return buf;
+}
+
+/**
+ * Plain text timeline.
+ */
+static void
+print_text
+   (rec_t *r,
+   uint32_t n,
+   double hz)
+{
+   uint32_t i;
+   double t;
+
+   for(i=0; i<n; i++) {
+      t = (double)(uint32_t)(r[i].time - r[0].time) * 1e6 / hz;
+      printf("%12.3f us  %-16s thread %08x  object %08x\n", t, event_name(r[i].event), r[i].thread, r[i].object);
+   }
+}
+
+/**
+ * Chrome trace JSON: one track per thread, callbacks on track 0.
+ */
+static void
+print_json
+   (rec_t *r,
+   uint32_t n,
+   double hz)
+{
+   uint32_t i;
+   double t;
+   const char *sep = "";
+
+   printf("{\"traceEvents\":[\n");
+   for(i=0; i<n; i++) {
+      t = (double)(uint32_t)(r[i].time - r[0].time) * 1e6 / hz;
+      switch(r[i].event) {
+         case TRACE_SWITCH:
+            printf("%s{\"name\":\"thread %08x\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":0,\"tid\":%u}", sep, r[i].thread, t, r[i].thread);
+            break;
+         case TRACE_PREEMPT:
+            printf("%s{\"name\":\"thread %08x\",\"ph\":\"E\",\"ts\":%.3f,\"pid\":0,\"tid\":%u,\"args\":{\"service\":\"preempt\"}}", sep, r[i].thread, t, r[i].thread);
+            break;
+         case TRACE_RETURN:
+            printf("%s{\"name\":\"thread %08x\",\"ph\":\"E\",\"ts\":%.3f,\"pid\":0,\"tid\":%u,\"args\":{\"service\":\"%s\"}}", sep, r[i].thread, t, r[i].thread, event_name(TRACE_SERVICE + r[i].object));
+            break;
+         case TRACE_CB_RUN:
+            printf("%s{\"name\":\"callback %08x\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":0,\"tid\":0}", sep, r[i].object, t);
+            break;
+         case TRACE_CB_END:
+            printf("%s{\"name\":\"callback %08x\",\"ph\":\"E\",\"ts\":%.3f,\"pid\":0,\"tid\":0}", sep, r[i].object, t);
+            break;
+         default:
+            printf("%s{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":0,\"tid\":%u,\"args\":{\"object\":\"%08x\"}}", sep, event_name(r[i].event), t, r[i].thread, r[i].object);
+            break;
+      }
+      sep = ",\n";
+   }
+   printf("\n]}\n");
+}
+
+int
+main
+   (int argc,
+   char *argv[])
+{
+   FILE *f;
+   uint8_t hdr[16], rec[TRACE_REC_SIZE];
+   uint32_t head, size, n, first, i;
+   uint8_t *raw;
+   rec_t *r;
+   double hz = 40000000.0;
+   int json = 0;
+   const char *name = NULL;
+
+   for(i=1; i<(uint32_t)argc; i++) {
+      if(!strcmp(argv[i], "-j")) json = 1;
+      else if(!strcmp(argv[i], "-f") && (i + 1 < (uint32_t)argc)) hz = atof(argv[++i]);
+      else name = argv[i];
+   }
+   if((name == NULL) || (hz <= 0)) {
+      fprintf(stderr, "usage: tracedump [-j] [-f hz] dump.bin\n");
+      return 2;
+   }
+
+   f = fopen(name, "rb");
+   if(f == NULL) {
+      perror(name);
+      return 1;
+   }
+   if((fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr)) || (le32(hdr) != TRACE_MAGIC) || (le32(hdr + 12) != TRACE_REC_SIZE)) {
+      fprintf(stderr, "%s: not a cronOS trace dump\n", name);
+      return 1;
+   }
+   head = le32(hdr + 4);
+   size = le32(hdr + 8);
+   if((size == 0) || (size & (size - 1))) {
+      fprintf(stderr, "%s: bad buffer size %u\n", name, size);
+      return 1;
+   }
+
+   /*
+    * Unroll the ring: the oldest record follows the newest one when the buffer wrapped.
+    */
+   raw = malloc((size_t)size * TRACE_REC_SIZE);
+   r = malloc((size_t)size * sizeof(rec_t));
+   if((raw == NULL) || (r == NULL)) return 1;
+   if(fread(raw, TRACE_REC_SIZE, size, f) != size) {
+      fprintf(stderr, "%s: truncated dump\n", name);
+      return 1;
+   }
+   fclose(f);
+   n = (head < size)? head : size;
+   first = (head < size)? 0 : (head & (size - 1));
+   for(i=0; i<n; i++) {
+      memcpy(rec, raw + (size_t)((first + i) & (size - 1)) * TRACE_REC_SIZE, TRACE_REC_SIZE);
+      r[i].time = le32(rec);
+      r[i].thread = le32(rec + 4);
+      r[i].object = le32(rec + 8);
+      r[i].event = rec[12];
+   }
+
+   if(json) print_json(r, n, hz);
+   else print_text(r, n, hz);
+   free(raw);
+   free(r);
+   return 0;
+}